@@ -0,0 +1,33 @@
+#!/usr/bin/env python3
+# Serves a directory (web by default) on http://localhost:6931 and opens a page of it in the
+# browser. Every response is sent with the headers that make the page cross origin isolated,
+# browsers only give SharedArrayBuffer, which the web_threads build needs, to such pages.
+#
+# usage: serve.py [directory] [page]
+
+import functools
+import http.server
+import sys
+import webbrowser
+
+PORT = 6931
+
+
+class Handler(http.server.SimpleHTTPRequestHandler):
+    extensions_map = {**http.server.SimpleHTTPRequestHandler.extensions_map,
+                      '.wasm': 'application/wasm'}
+
+    def end_headers(self):
+        self.send_header('Cross-Origin-Opener-Policy', 'same-origin')
+        self.send_header('Cross-Origin-Embedder-Policy', 'require-corp')
+        super().end_headers()
+
+
+directory = sys.argv[1] if len(sys.argv) > 1 else 'web'
+page = sys.argv[2] if len(sys.argv) > 2 else ''
+
+server = http.server.ThreadingHTTPServer(('localhost', PORT),
+                                         functools.partial(Handler, directory=directory))
+print(f'Serving {directory} on http://localhost:{PORT}/')
+webbrowser.open(f'http://localhost:{PORT}/{page}')
+server.serve_forever()
@@ -0,0 +1,73 @@
+#include "arena.h"
+
+#include "util.h"
+
+#include <stdlib.h>
+
+// objects start at the first cache line after the slab header
+#define SLAB_HEADER_SIZE                                                                           \
+	((sizeof(struct arena_slab) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE)
+
+void arena_init(struct arena *a, const size_t object_size) {
+	a->slabs = NULL;
+	// round up to whole cache lines, so every object starts at a cache line
+	a->object_size = (object_size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+	a->per_slab = (ARENA_SLAB_SIZE - SLAB_HEADER_SIZE) / a->object_size;
+	// no slab yet, the first allocation creates one
+	a->free_list = NULL;
+	a->used = a->per_slab;
+	a->slab_count = 0;
+	a->object_count = 0;
+}
+
+// Returns a cache line aligned, uninitialized object
+void *arena_alloc(struct arena *a) {
+	struct arena_slab *slab;
+	void *object;
+
+	if (a->free_list != NULL) {
+		object = a->free_list;
+		a->free_list = *(void **)object;
+		a->object_count++;
+		return object;
+	}
+
+	if (a->used >= a->per_slab) {
+		slab = aligned_alloc(CACHE_LINE_SIZE, ARENA_SLAB_SIZE);
+
+		if (slab == NULL) {
+			handle_alloc_error();
+		}
+
+		slab->next = a->slabs;
+		a->slabs = slab;
+		a->used = 0;
+		a->slab_count++;
+	}
+
+	a->object_count++;
+
+	return (uint8_t *)a->slabs + SLAB_HEADER_SIZE + a->object_size * a->used++;
+}
+
+// object_count only counts objects that are in use, released objects stay in their slab
+void arena_release(struct arena *a, void *object) {
+	*(void **)object = a->free_list;
+	a->free_list = object;
+	a->object_count--;
+}
+
+void arena_free(struct arena *a) {
+	struct arena_slab *slab;
+
+	while (a->slabs != NULL) {
+		slab = a->slabs;
+		a->slabs = slab->next;
+		free(slab);
+	}
+
+	a->free_list = NULL;
+	a->used = a->per_slab;
+	a->slab_count = 0;
+	a->object_count = 0;
+}
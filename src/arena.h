@@ -0,0 +1,32 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_SLAB_SIZE (512 * 1024)
+#define CACHE_LINE_SIZE 64
+
+struct arena_slab {
+	struct arena_slab *next;
+};
+
+// Allocates objects of one size from large slabs. Objects given back with arena_release are reused
+// by later allocations, the slabs are only freed all at once with arena_free.
+struct arena {
+	struct arena_slab *slabs;
+	// released objects, linked through their first bytes
+	void *free_list;
+	size_t object_size;
+	uint32_t per_slab, used, slab_count, object_count;
+};
+
+void arena_init(struct arena *a, const size_t object_size);
+
+void *arena_alloc(struct arena *a);
+
+void arena_release(struct arena *a, void *object);
+
+void arena_free(struct arena *a);
+
+#endif
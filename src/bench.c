@@ -0,0 +1,752 @@
+#ifdef BENCH
+
+#include "chunk.h"
+#include "evict.h"
+#include "game.h"
+#include "pool.h"
+#include "prefetch.h"
+#include "renderer.h"
+#include "save.h"
+#include "stats.h"
+#include "trace.h"
+#include "util.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#ifdef POOL_THREADS
+#include <pthread.h>
+#endif
+
+#define BENCH_SEED 1234
+#define BENCH_LOOKUPS (1 << 22)
+// most games bench_games plays at the same time
+#define BENCH_GAMES_MAX 64
+// the web build has no build directory in its in-memory file system
+#ifdef __EMSCRIPTEN__
+#define BENCH_SAVE_FILE "bench.save"
+// written when the benchmarks are built with -DTRACE
+#define BENCH_TRACE_FILE "bench.trace.json"
+#else
+#define BENCH_SAVE_FILE "build/bench.save"
+#define BENCH_TRACE_FILE "build/bench.trace.json"
+#endif
+
+// results are written here so the compiler can not drop the benchmarked calls
+static volatile uintptr_t sink;
+
+// chunks inside the rectangle are visible, like the chunks inside the window
+struct bench_view {
+	uint32_t x, y, w, h;
+};
+
+// view of the scenarios that play one game
+static struct bench_view view;
+
+static bool in_view(const struct chunk *c, void *data) {
+	const struct bench_view *v = data;
+
+	return c->x - v->x < v->w && c->y - v->y < v->h;
+}
+
+static void set_visible(const uint32_t x, const uint32_t y, const uint32_t w, const uint32_t h) {
+	view.x = x;
+	view.y = y;
+	view.w = w;
+	view.h = h;
+}
+
+// starts a game that shows view
+static struct game *start_game() {
+	struct game *game;
+
+	game = init_game(BENCH_SEED);
+	game->visibility = in_view;
+	game->visibility_data = &view;
+
+	return game;
+}
+
+static uint64_t now_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// cpu time of the calling thread, other threads do not add to it even when they share its core
+static uint64_t thread_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static long peak_rss_kb() {
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_maxrss;
+}
+
+static uint32_t bench_rand(uint32_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+// Prints one result line of space separated key=value pairs, params are the scenario specific
+// pairs. Lines of the same scenario and params can be compared between builds. The counters of the
+// game so far follow on a stats line (see print_stats).
+static void report(struct game *game, const char *scenario, const char *params, const uint64_t ops,
+				   const uint64_t ns) {
+	printf("bench=%s%s%s ops=%llu ns_per_op=%.2f ops_per_sec=%.0f peak_rss_kb=%ld\n", scenario,
+		   *params ? " " : "", params, (unsigned long long)ops, (double)ns / ops, ops / (ns / 1e9),
+		   peak_rss_kb());
+	print_stats(game, scenario);
+}
+
+static void create_square(struct game *game, const uint32_t side) {
+	uint32_t x, y;
+
+	for (y = 0; y < side; y++) {
+		for (x = 0; x < side; x++) {
+			get_chunk_by_pos(game, x, y, true);
+		}
+	}
+}
+
+// Creates a side * side square of chunks and then looks up random chunks inside of it, the cost
+// per lookup must not depend on side
+static void bench_lookup(const uint32_t side) {
+	struct game *game;
+	uint64_t start, create_ns, lookup_ns;
+	char params[64];
+	uintptr_t sum;
+	uint32_t i, state;
+
+	game = start_game();
+
+	start = now_ns();
+	create_square(game, side);
+	create_ns = now_ns() - start;
+
+	state = BENCH_SEED;
+	sum = 0;
+	start = now_ns();
+	for (i = 0; i < BENCH_LOOKUPS; i++) {
+		sum += (uintptr_t)get_chunk_by_pos(game, bench_rand(&state) % side,
+										   bench_rand(&state) % side, false);
+	}
+	lookup_ns = now_ns() - start;
+
+	sink = sum;
+
+	snprintf(params, sizeof(params), "chunks=%u slabs=%u", side * side,
+			 game->chunk_arena.slab_count);
+	report(game, "create", params, side * side, create_ns);
+	report(game, "lookup", params, BENCH_LOOKUPS, lookup_ns);
+
+	cleanup(game);
+}
+
+// Places the mines of chunks with different seeds, this is what every new chunk costs once
+static void bench_populate(const uint32_t count) {
+	struct game *game;
+	static struct chunk c;
+	uint64_t start, populate_ns;
+	uint32_t i, state;
+	uintptr_t sum;
+
+	game = start_game();
+	// the mines of c come from the arena of this game
+	memset(&c, 0, sizeof(c));
+
+	state = BENCH_SEED;
+	sum = 0;
+	start = now_ns();
+	for (i = 0; i < count; i++) {
+		UNSET(CHUNK_POPULATED, c.flags);
+		c.seed = bench_rand(&state) | 1;
+		populate_chunk(game, &c);
+		sum += c.mines[i % CHUNK_SIZE];
+	}
+	populate_ns = now_ns() - start;
+
+	sink = sum;
+
+	report(game, "populate", "", count, populate_ns);
+
+	cleanup(game);
+}
+
+// Pans over a strip of 3 rows of chunks and counts the mines of a field in the middle row, the
+// worker prepares the chunks PREFETCH_FRAMES steps ahead. Only the cpu time of the main thread
+// counts, with fewer cores than threads the wall time would include the worker.
+static void bench_prefetch(const uint32_t steps, const bool worker) {
+	struct game *game;
+	uint64_t start, pan_ns;
+	char params[64];
+	uint32_t i, y;
+	int sum;
+
+	game = start_game();
+	set_visible(0, 0, -1, -1);
+
+	if (worker) {
+		start_prefetch(game);
+	}
+
+	sum = 0;
+	start = thread_ns();
+	for (i = 0; i < steps; i++) {
+		for (y = 0; y < 3; y++) {
+			prefetch_chunk(game, i + PREFETCH_FRAMES, y);
+		}
+		for (y = 0; y < 3; y++) {
+			get_chunk_by_pos(game, i, y, true);
+		}
+		sum += field_get_mines(game, get_chunk_by_pos(game, i, 1, false), CHUNK_SIZE / 2,
+							   CHUNK_SIZE / 2);
+	}
+	pan_ns = thread_ns() - start;
+
+	sink = sum;
+
+	snprintf(params, sizeof(params), "worker=%d", worker);
+	report(game, "prefetch", params, steps * 3, pan_ns);
+
+	cleanup(game);
+}
+
+static int count_all(struct game *game, const uint32_t side) {
+	struct chunk *c;
+	uint32_t x, y, i;
+	int sum;
+
+	sum = 0;
+	for (y = 0; y < side; y++) {
+		for (x = 0; x < side; x++) {
+			c = get_chunk_by_pos(game, x, y, false);
+			for (i = 0; i < CHUNK_SIZE * CHUNK_SIZE; i++) {
+				sum += field_get_mines(game, c, i % CHUNK_SIZE, i / CHUNK_SIZE);
+			}
+		}
+	}
+
+	return sum;
+}
+
+// Gets the mine count of every field of side * side visible chunks, the first call for a field
+// computes it, the second one is cached
+static void bench_count(const uint32_t side) {
+	struct game *game;
+	uint64_t start, first_ns, cached_ns;
+	char params[64];
+
+	game = start_game();
+	set_visible(0, 0, side, side);
+	create_square(game, side);
+
+	start = now_ns();
+	sink = count_all(game, side);
+	first_ns = now_ns() - start;
+
+	start = now_ns();
+	sink = count_all(game, side);
+	cached_ns = now_ns() - start;
+
+	snprintf(params, sizeof(params), "chunks=%u", side * side);
+	report(game, "count", params, side * side * CHUNK_SIZE * CHUNK_SIZE, first_ns);
+	report(game, "count_cached", params, side * side * CHUNK_SIZE * CHUNK_SIZE, cached_ns);
+
+	cleanup(game);
+}
+
+// Uncovers one field without surrounding mines in the middle of a side * side chunk viewport with
+// few mines, so the flood fill opens (almost) the whole viewport
+static void bench_flood(const uint32_t side, const uint32_t mine_percentage) {
+	struct game *game;
+	uint64_t start, fill_ns;
+	uint32_t x, y, i, uncovered;
+	struct chunk *c;
+	char params[64];
+
+	game = start_game();
+	game->mine_threshold = -1U / 100 * (100 - mine_percentage);
+	set_visible(0, 0, side, side);
+
+	c = get_chunk_by_pos(game, side / 2, side / 2, true);
+	i = 0;
+	while (field_get_mines(game, c, i % CHUNK_SIZE, i / CHUNK_SIZE) != 0 ||
+		   ISSET(FIELD_MINE, c->fields[i])) {
+		i++;
+	}
+
+	start = now_ns();
+	uncover_field_inbounds(game, c, i % CHUNK_SIZE, i / CHUNK_SIZE);
+	fill_ns = now_ns() - start;
+
+	uncovered = 0;
+	for (y = 0; y < side; y++) {
+		for (x = 0; x < side; x++) {
+			c = get_chunk_by_pos(game, x, y, false);
+			for (i = 0; c != NULL && c->fields != NULL && i < CHUNK_SIZE * CHUNK_SIZE; i++) {
+				uncovered += ISSET(FIELD_UNCOVERED, c->fields[i]) != 0;
+			}
+		}
+	}
+
+	snprintf(params, sizeof(params), "chunks=%u mines=%u uncovered=%u", side * side,
+			 mine_percentage, uncovered);
+	report(game, "flood", params, uncovered, fill_ns);
+
+	cleanup(game);
+}
+
+// Uncovers the same field as bench_flood with the fill running on threads threads, the fields it
+// uncovers are the same for every number of threads
+static void bench_parallel(const uint32_t side, const uint32_t mine_percentage,
+						   const uint32_t threads) {
+	struct game *game;
+	uint64_t start, fill_ns;
+	uint32_t x, y, i, uncovered;
+	struct chunk *c;
+	char params[64];
+
+	game = start_game();
+	game->mine_threshold = -1U / 100 * (100 - mine_percentage);
+	game->fill_threads = threads;
+	set_visible(0, 0, side, side);
+
+	c = get_chunk_by_pos(game, side / 2, side / 2, true);
+	i = 0;
+	while (field_get_mines(game, c, i % CHUNK_SIZE, i / CHUNK_SIZE) != 0 ||
+		   ISSET(FIELD_MINE, c->fields[i])) {
+		i++;
+	}
+
+	// the threads are started outside of the measurement
+	start_pool(threads);
+
+	start = now_ns();
+	uncover_field_inbounds(game, c, i % CHUNK_SIZE, i / CHUNK_SIZE);
+	fill_ns = now_ns() - start;
+
+	uncovered = 0;
+	for (y = 0; y < side; y++) {
+		for (x = 0; x < side; x++) {
+			c = get_chunk_by_pos(game, x, y, false);
+			for (i = 0; c != NULL && c->fields != NULL && i < CHUNK_SIZE * CHUNK_SIZE; i++) {
+				uncovered += ISSET(FIELD_UNCOVERED, c->fields[i]) != 0;
+			}
+		}
+	}
+
+	snprintf(params, sizeof(params), "chunks=%u mines=%u threads=%u uncovered=%u", side * side,
+			 mine_percentage, threads, uncovered);
+	report(game, "parallel", params, uncovered, fill_ns);
+
+	cleanup(game);
+}
+
+// games of one thread of bench_games, they show the chunks of their own view
+struct bench_player {
+	struct bench_view view;
+	uint32_t rounds;
+	uint64_t uncovered;
+	// the last game, kept for its stats
+	struct game *game;
+};
+
+// Plays player->rounds games one after another, each one is a fill over the view like bench_flood
+// with its own seed
+static void *play_games(void *arg) {
+	struct bench_player *player = arg;
+	struct game *game;
+	uint32_t round, x, y, i;
+	struct chunk *c;
+
+	trace_thread_name("game");
+
+	game = NULL;
+	for (round = 0; round < player->rounds; round++) {
+		if (game != NULL) {
+			free_game(game);
+		}
+
+		game = init_game(BENCH_SEED + round);
+		game->mine_threshold = -1U / 100 * 98;
+		game->visibility = in_view;
+		game->visibility_data = &player->view;
+
+		c = get_chunk_by_pos(game, player->view.w / 2, player->view.h / 2, true);
+		i = 0;
+		while (field_get_mines(game, c, i % CHUNK_SIZE, i / CHUNK_SIZE) != 0 ||
+			   ISSET(FIELD_MINE, c->fields[i])) {
+			i++;
+		}
+
+		uncover_field_inbounds(game, c, i % CHUNK_SIZE, i / CHUNK_SIZE);
+
+		for (y = 0; y < player->view.h; y++) {
+			for (x = 0; x < player->view.w; x++) {
+				c = get_chunk_by_pos(game, x, y, false);
+				for (i = 0; c != NULL && c->fields != NULL && i < CHUNK_SIZE * CHUNK_SIZE; i++) {
+					player->uncovered += ISSET(FIELD_UNCOVERED, c->fields[i]) != 0;
+				}
+			}
+		}
+	}
+
+	player->game = game;
+
+	return NULL;
+}
+
+// Plays count independent games at the same time, each on its own thread, with the same rounds
+// of side * side chunk fills. The games share nothing, so the fields uncovered per second grow
+// with the number of games up to the number of cores.
+static void bench_games(const uint32_t side, const uint32_t rounds, const uint32_t count) {
+	static struct bench_player players[BENCH_GAMES_MAX];
+#ifdef POOL_THREADS
+	pthread_t threads[BENCH_GAMES_MAX];
+#endif
+	uint64_t start, play_ns, uncovered;
+	uint32_t i, started;
+	char params[64];
+
+	memset(players, 0, sizeof(players));
+	for (i = 0; i < count; i++) {
+		players[i].view.w = players[i].view.h = side;
+		players[i].rounds = rounds;
+	}
+
+	start = now_ns();
+
+	started = 0;
+#ifdef POOL_THREADS
+	for (; started < count; started++) {
+		if (pthread_create(&threads[started], NULL, play_games, &players[started]) != 0) {
+			printf("Could only start %u threads, the other games run on this one\n", started);
+			break;
+		}
+	}
+#endif
+	for (i = started; i < count; i++) {
+		play_games(&players[i]);
+	}
+#ifdef POOL_THREADS
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+#endif
+
+	play_ns = now_ns() - start;
+
+	uncovered = 0;
+	for (i = 0; i < count; i++) {
+		uncovered += players[i].uncovered;
+	}
+
+	snprintf(params, sizeof(params), "games=%u chunks=%u rounds=%u", count, side * side, rounds);
+	report(players[0].game, "games", params, uncovered, play_ns);
+
+	for (i = 0; i < count; i++) {
+		free_game(players[i].game);
+	}
+}
+
+// Uncovers the same field as bench_flood with only its chunk visible, so the fill stops at its
+// edges. Then the whole side * side viewport becomes visible and is_visible resumes the fill from
+// the frontier of every chunk that it reached.
+static void bench_resume(const uint32_t side, const uint32_t mine_percentage) {
+	struct game *game;
+	uint64_t start, resume_ns;
+	uint32_t x, y, i, uncovered;
+	struct chunk *c;
+	char params[64];
+
+	game = start_game();
+	game->mine_threshold = -1U / 100 * (100 - mine_percentage);
+	set_visible(side / 2, side / 2, 1, 1);
+
+	c = get_chunk_by_pos(game, side / 2, side / 2, true);
+	i = 0;
+	while (field_get_mines(game, c, i % CHUNK_SIZE, i / CHUNK_SIZE) != 0 ||
+		   ISSET(FIELD_MINE, c->fields[i])) {
+		i++;
+	}
+	uncover_field_inbounds(game, c, i % CHUNK_SIZE, i / CHUNK_SIZE);
+
+	set_visible(0, 0, side, side);
+
+	start = now_ns();
+	for (y = 0; y < side; y++) {
+		for (x = 0; x < side; x++) {
+			is_visible(game, get_chunk_by_pos(game, x, y, true));
+		}
+	}
+	resume_ns = now_ns() - start;
+
+	uncovered = 0;
+	for (y = 0; y < side; y++) {
+		for (x = 0; x < side; x++) {
+			c = get_chunk_by_pos(game, x, y, false);
+			for (i = 0; c->fields != NULL && i < CHUNK_SIZE * CHUNK_SIZE; i++) {
+				uncovered += ISSET(FIELD_UNCOVERED, c->fields[i]) != 0;
+			}
+		}
+	}
+
+	snprintf(params, sizeof(params), "chunks=%u mines=%u uncovered=%u", side * side,
+			 mine_percentage, uncovered);
+	report(game, "resume", params, side * side, resume_ns);
+
+	cleanup(game);
+}
+
+// Saves the world of a side * side flood fill, then loads it again. Loading maps the file and only
+// creates the chunks in the window, the others are loaded when they are first looked up.
+static void bench_save(const uint32_t side) {
+	struct game *game;
+	uint64_t start, save_ns, load_ns, fault_ns;
+	uint32_t x, y, i, saved;
+	struct chunk *c;
+	char params[64];
+
+	game = start_game();
+	game->mine_threshold = -1U / 100 * 98;
+	set_visible(0, 0, side, side);
+
+	c = get_chunk_by_pos(game, side / 2, side / 2, true);
+	i = 0;
+	while (field_get_mines(game, c, i % CHUNK_SIZE, i / CHUNK_SIZE) != 0 ||
+		   ISSET(FIELD_MINE, c->fields[i])) {
+		i++;
+	}
+	uncover_field_inbounds(game, c, i % CHUNK_SIZE, i / CHUNK_SIZE);
+
+	start = now_ns();
+	if (save_game(game, BENCH_SAVE_FILE)) {
+		cleanup(game);
+		return;
+	}
+	save_ns = now_ns() - start;
+
+	cleanup(game);
+
+	start = now_ns();
+	game = load_game(BENCH_SAVE_FILE);
+	if (game == NULL) {
+		return;
+	}
+	load_ns = now_ns() - start;
+	game->visibility = in_view;
+	game->visibility_data = &view;
+
+	saved = game->save->chunks_count;
+	snprintf(params, sizeof(params), "chunks=%u loaded=%u", saved, game->chunks_count);
+
+	start = now_ns();
+	for (y = 0; y < side; y++) {
+		for (x = 0; x < side; x++) {
+			sink = (uintptr_t)get_chunk_by_pos(game, x, y, false);
+		}
+	}
+	fault_ns = now_ns() - start;
+
+	report(game, "save", params, saved, save_ns);
+	report(game, "load", params, 1, load_ns);
+	report(game, "load_chunk", params, side * side, fault_ns);
+
+	cleanup(game);
+	remove(BENCH_SAVE_FILE);
+}
+
+// Pans a window of chunks along a row, uncovering a field in every new column, with a memory
+// budget in MiB (0 for none). Then looks up every chunk of the row again, evicted ones are loaded
+// again.
+static void bench_evict(const uint32_t budget_mb, const uint32_t steps) {
+	struct game *game;
+	uint64_t start, pan_ns, reload_ns;
+	uint32_t step, x, y, i;
+	struct chunk *c;
+	char params[96];
+
+	game = start_game();
+	game->mine_threshold = -1U / 100 * 85;
+	game->memory_budget = budget_mb ? (size_t)budget_mb << 20 : SIZE_MAX;
+
+	start = now_ns();
+	for (step = 0; step < steps; step++) {
+		set_visible(step, 0, 4, 3);
+
+		for (y = 0; y < 3; y++) {
+			c = get_chunk_by_pos(game, step + 3, y, true);
+			for (i = 0; i < CHUNK_SIZE * CHUNK_SIZE; i += CHUNK_SIZE + 1) {
+				if (field_get_mines(game, c, i % CHUNK_SIZE, i / CHUNK_SIZE) == 0 &&
+					!ISSET(FIELD_MINE, c->fields[i])) {
+					uncover_field_inbounds(game, c, i % CHUNK_SIZE, i / CHUNK_SIZE);
+					break;
+				}
+			}
+		}
+
+		// the renderer calls this once per frame
+		evict_chunks(game);
+	}
+	pan_ns = now_ns() - start;
+
+	snprintf(params, sizeof(params), "budget_mb=%u hot=%u cold=%u slabs=%u", budget_mb,
+			 game->chunks_count, game->cold_count, game->chunk_arena.slab_count);
+	report(game, "evict_pan", params, steps, pan_ns);
+
+	start = now_ns();
+	for (x = 0; x < steps; x++) {
+		for (y = 0; y < 3; y++) {
+			sink = (uintptr_t)get_chunk_by_pos(game, x, y, false);
+		}
+		evict_chunks(game);
+	}
+	reload_ns = now_ns() - start;
+
+	report(game, "evict_reload", params, steps * 3, reload_ns);
+
+	cleanup(game);
+}
+
+// Pans a screen of 2 * 2 chunks (the window at the default zoom) over a row of new chunks and
+// uncovers a field without surrounding mines on every click_every-th screen (never for 0). Like the
+// renderer, only the uncovered fields of the screen get their mine counts, the other chunks stay
+// covered. bytes_per_screen is the memory the chunks of one explored screen use.
+static void bench_explore(const uint32_t screens, const uint32_t click_every) {
+	struct game *game;
+	uint64_t start, explore_ns;
+	uint32_t step, x, y, i;
+	struct chunk *c;
+	char params[64];
+
+	game = start_game();
+
+	start = now_ns();
+	for (step = 0; step < screens; step++) {
+		set_visible(step * 2, 0, 2, 2);
+
+		c = get_chunk_by_pos(game, step * 2, 0, true);
+		for (i = 0; click_every != 0 && step % click_every == 0 && i < CHUNK_SIZE * CHUNK_SIZE;
+			 i++) {
+			if (field_get_mines(game, c, i % CHUNK_SIZE, i / CHUNK_SIZE) == 0 &&
+				!ISSET(FIELD_MINE, c->fields[i])) {
+				uncover_field_inbounds(game, c, i % CHUNK_SIZE, i / CHUNK_SIZE);
+				break;
+			}
+		}
+
+		for (y = 0; y < 2; y++) {
+			for (x = step * 2; x < step * 2 + 2; x++) {
+				c = get_chunk_by_pos(game, x, y, true);
+				is_visible(game, c);
+				for (i = 0; c->fields != NULL && i < CHUNK_SIZE * CHUNK_SIZE; i++) {
+					if (ISSET(FIELD_UNCOVERED, c->fields[i])) {
+						sink = field_get_mines(game, c, i % CHUNK_SIZE, i / CHUNK_SIZE);
+					}
+				}
+			}
+		}
+	}
+	explore_ns = now_ns() - start;
+
+	snprintf(params, sizeof(params), "screens=%u click_every=%u bytes_per_screen=%zu", screens,
+			 click_every, chunk_memory(game) / screens);
+	report(game, "explore", params, screens, explore_ns);
+
+	cleanup(game);
+}
+
+// Runs all scenarios, or only the one named by the first argument. The output is one key=value line
+// per result (see report), seeds are fixed so runs of different builds do the same work.
+int main(int argc, char **argv) {
+	const char *only = argc > 1 ? argv[1] : NULL;
+	uint32_t side, threads;
+
+	trace_thread_name("main");
+	start_trace(BENCH_TRACE_FILE);
+
+	if (only == NULL || strcmp(only, "populate") == 0) {
+		bench_populate(1 << 16);
+	}
+
+	if (only == NULL || strcmp(only, "count") == 0) {
+		bench_count(16);
+	}
+
+	if (only == NULL || strcmp(only, "flood") == 0) {
+		for (side = 2; side <= 16; side *= 2) {
+			bench_flood(side, 2);
+		}
+	}
+
+	if (only == NULL || strcmp(only, "resume") == 0) {
+		bench_resume(8, 2);
+	}
+
+	// 1 to the number of cores threads, at least up to 4 to show the cost of the rounds
+	if (only == NULL || strcmp(only, "parallel") == 0) {
+		for (threads = 1; threads <= cpu_count() || threads <= 4; threads *= 2) {
+			bench_parallel(32, 2, threads);
+		}
+	}
+
+	// 1 to the number of cores games at the same time
+	if (only == NULL || strcmp(only, "games") == 0) {
+		for (threads = 1; threads <= cpu_count() && threads <= BENCH_GAMES_MAX; threads *= 2) {
+			bench_games(8, 64, threads);
+		}
+	}
+
+	if (only == NULL || strcmp(only, "prefetch") == 0) {
+		bench_prefetch(4096, false);
+		bench_prefetch(4096, true);
+	}
+
+	if (only == NULL || strcmp(only, "save") == 0) {
+		bench_save(32);
+	}
+
+	// with a budget first, peak_rss_kb only shows the difference in this order
+	if (only == NULL || strcmp(only, "evict") == 0) {
+		bench_evict(8, 2048);
+		bench_evict(0, 2048);
+	}
+
+	if (only == NULL || strcmp(only, "explore") == 0) {
+		bench_explore(1024, 0);
+		bench_explore(1024, 8);
+		bench_explore(1024, 1);
+	}
+
+	// last, peak_rss_kb never goes down again after the biggest square
+	if (only == NULL || strcmp(only, "lookup") == 0) {
+		// 1k to 1M chunks
+		for (side = 32; side <= 1024; side *= 2) {
+			bench_lookup(side);
+		}
+	}
+
+	// the threads of the pool record events until they stop
+	stop_pool();
+	flush_trace();
+
+	return 0;
+}
+
+#endif
@@ -1,55 +1,113 @@
 #include "chunk.h"
 
+#include "arena.h"
 #include "game.h"
 #include "renderer.h"
+#include "evict.h"
+#include "lod.h"
+#include "pool.h"
+#include "prefetch.h"
+#include "save.h"
+#include "stats.h"
+#include "trace.h"
 #include "util.h"
 
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-void alloc_chunk_list(const uint32_t size) {
-	struct chunk **new_chunks;
+// Mixes the chunk position into a table index, the low bits of x and y alone cluster badly because
+// neighboring chunks are created together
+uint32_t chunk_hash(const uint32_t x, const uint32_t y) {
+	uint64_t h;
 
-	if (game->chunks == NULL) {
-		new_chunks = malloc(sizeof(game->chunks) * size);
-	} else {
-		new_chunks = realloc(game->chunks, sizeof(game->chunks) * size);
+	h = ((uint64_t)x << 32 | y) * 0x9e3779b97f4a7c15;
+	h ^= h >> 32;
+
+	return h;
+}
+
+static void insert_chunk(struct chunk_slot *table, const uint32_t mask, struct chunk *c) {
+	uint32_t i;
+
+	i = chunk_hash(c->x, c->y) & mask;
+	while (table[i].c != NULL) {
+		i = (i + 1) & mask;
 	}
 
+	table[i].x = c->x;
+	table[i].y = c->y;
+	table[i].c = c;
+}
+
+// Resizes the chunk table to size slots (must be a power of two) and rehashes all chunks in it
+void alloc_chunk_table(struct game *game, const uint32_t size) {
+	struct chunk_slot *new_chunks;
+	uint32_t i;
+
+	new_chunks = calloc(size, sizeof(*game->chunks));
+
 	if (new_chunks == NULL) {
 		handle_alloc_error();
 	}
 
+	if (game->chunks != NULL) {
+		for (i = 0; i < game->chunks_size; i++) {
+			if (game->chunks[i].c != NULL) {
+				insert_chunk(new_chunks, size - 1, game->chunks[i].c);
+			}
+		}
+		free(game->chunks);
+	}
+
 	game->chunks = new_chunks;
 	game->chunks_size = size;
 }
 
-static void push_chunk(struct chunk *c) {
-	// should never be greater, only equal
-	if (game->chunks_count >= game->chunks_size) {
-		alloc_chunk_list(game->chunks_size + CHUNK_LIST_SIZE);
+static void push_chunk(struct game *game, struct chunk *c) {
+	// keep the load factor at or below 1/2 so probe sequences stay short
+	if ((game->chunks_count + 1) * 2 > game->chunks_size) {
+		alloc_chunk_table(game, game->chunks_size * 2);
 	}
 
-	game->chunks[game->chunks_count++] = c;
+	insert_chunk(game->chunks, game->chunks_size - 1, c);
+	game->chunks_count++;
 }
 
-static struct chunk *create_chunk(const uint32_t x, const uint32_t y);
+static struct chunk *create_chunk(struct game *game, const uint32_t x, const uint32_t y);
 
-struct chunk *get_chunk_by_pos(const uint32_t x, const uint32_t y, const bool create) {
+// returns the chunk at x, y if it was created, without loading it from the save file
+struct chunk *find_chunk(struct game *game, const uint32_t x, const uint32_t y) {
+	const uint32_t mask = game->chunks_size - 1;
+	struct chunk_slot *slot;
 	uint32_t i;
 
-	for (i = 0; i < game->chunks_count; i++) {
-		if (game->chunks[i]->x == x && game->chunks[i]->y == y) {
-			return game->chunks[i];
+	// the position is stored in the slot, so only the chunk that is returned is dereferenced
+	for (i = chunk_hash(x, y) & mask; (slot = &game->chunks[i])->c != NULL; i = (i + 1) & mask) {
+		if (slot->x == x && slot->y == y) {
+			return slot->c;
 		}
 	}
 
-	if (create) {
-		return create_chunk(x, y);
+	return NULL;
+}
+
+struct chunk *get_chunk_by_pos(struct game *game, const uint32_t x, const uint32_t y,
+							   const bool create) {
+	struct chunk *c;
+
+	STAT_ADD(STAT_CHUNK_LOOKUPS, 1);
+
+	c = find_chunk(game, x, y);
+
+	// evicted chunks and chunks in the save file exist, they are loaded again when they are needed
+	if (c == NULL &&
+		(create || find_cold_chunk(game, x, y) != NULL || find_saved_chunk(game, x, y) != NULL)) {
+		c = create_chunk(game, x, y);
 	}
 
-	return NULL;
+	return c;
 }
 
 static uint32_t xorshift32(uint32_t x) {
@@ -59,20 +117,71 @@ static uint32_t xorshift32(uint32_t x) {
 	return x;
 }
 
-static struct chunk *create_chunk(const uint32_t x, const uint32_t y) {
-	struct chunk *c, *n;
+uint32_t chunk_seed(struct game *game, const uint32_t x, const uint32_t y) {
+	return xorshift32(xorshift32(xorshift32(x) ^ y) ^ game->seed) | 1;
+}
+
+static struct chunk_block *get_chunk_block(struct chunk *c) {
+	return (struct chunk_block *)(c - CHUNK_BLOCK_POS(c->x, c->y));
+}
+
+// Counts the uncovered and flagged fields of a chunk that was restored, the pyramid already has
+// them if the chunk was evicted, update_lod only adds the difference
+static void summarize_chunk(struct game *game, struct chunk *c) {
+	uint32_t i;
+
+	// a chunk that was evicted with only a frontier has no fields
+	for (i = 0; c->fields != NULL && i < CHUNK_SIZE * CHUNK_SIZE; i++) {
+		if (ISSET(FIELD_UNCOVERED, c->fields[i])) {
+			c->tile[LOD_TILE_POS(i % CHUNK_SIZE, i / CHUNK_SIZE)]++;
+			c->uncovered_count++;
+		}
+		if (ISSET(FIELD_FLAG, c->fields[i])) {
+			c->flags_count++;
+		}
+	}
+
+	queue_summary(game, c);
+}
+
+static struct chunk *create_chunk(struct game *game, const uint32_t x, const uint32_t y) {
+	struct chunk *neighbors[9], *c, *n;
+	struct chunk_block *block;
 	int i, j;
 
-	c = calloc(1, sizeof(struct chunk));
+	STAT_ADD(STAT_CHUNKS_CREATED, 1);
+	TRACE_BEGIN(start);
 
-	if (c == NULL) {
-		handle_alloc_error();
+	block = NULL;
+
+	for (i = -1; i <= 1; i++) {
+		for (j = -1; j <= 1; j++) {
+			if (i == 0 && j == 0) {
+				continue;
+			}
+			n = find_chunk(game, x + j, y + i);
+			neighbors[NPOS(j, i)] = n;
+			// all chunks of a block are neighbors of each other
+			if (n != NULL && n->x >> CHUNK_BLOCK_2LOG == x >> CHUNK_BLOCK_2LOG &&
+				n->y >> CHUNK_BLOCK_2LOG == y >> CHUNK_BLOCK_2LOG) {
+				block = get_chunk_block(n);
+			}
+		}
 	}
 
+	if (block == NULL) {
+		block = arena_alloc(&game->chunk_arena);
+	}
+
+	c = &block->chunks[CHUNK_BLOCK_POS(x, y)];
+	memset(c, 0, sizeof(struct chunk));
+
 	c->x = x;
 	c->y = y;
+	c->used = game->tick;
+	c->flags = CHUNK_CHANGED;
 
-	c->seed = xorshift32(xorshift32(xorshift32(x) ^ y) ^ game->seed) | 1;
+	c->seed = chunk_seed(game, x, y);
 
 	// link neighbors
 	for (i = -1; i <= 1; i++) {
@@ -80,7 +189,7 @@ static struct chunk *create_chunk(const uint32_t x, const uint32_t y) {
 			if (i == 0 && j == 0) {
 				continue;
 			}
-			n = get_chunk_by_pos(x + j, y + i, false);
+			n = neighbors[NPOS(j, i)];
 			if (n != NULL) {
 				n->neighbors[NPOS(-j, -i)] = c;
 			}
@@ -88,244 +197,1147 @@ static struct chunk *create_chunk(const uint32_t x, const uint32_t y) {
 		}
 	}
 
-	push_chunk(c);
+	push_chunk(game, c);
+
+	// an evicted chunk is newer than the one in the save file
+	if (restore_cold_chunk(game, c) || restore_chunk(game, c)) {
+		summarize_chunk(game, c);
+	}
+
+	TRACE_END(start, "create_chunk", "x", x, "y", y);
 
 	return c;
 }
 
-static void uncover_field_inbounds_recalculate(struct chunk *c, uint32_t x, uint32_t y);
+// Removes c from the chunk table and unlinks it from its neighbors, its block is released when no
+// other chunk uses it. Only call this while no flood fill runs, pointers to c become invalid.
+void evict_chunk(struct game *game, struct chunk *c) {
+	const uint32_t mask = game->chunks_size - 1;
+	struct chunk_block *block;
+	uint32_t i, j, home, x, y;
+	int n;
 
-void check_covered_fields(struct chunk *c) {
-	uint32_t i;
+	for (i = chunk_hash(c->x, c->y) & mask; game->chunks[i].c != c; i = (i + 1) & mask) {
+	}
 
-	if (game->dead) {
-		return;
+	// backward shift deletion, later slots of the probe sequence that may move into the hole do so,
+	// lookups would stop at the hole otherwise
+	for (j = (i + 1) & mask; game->chunks[j].c != NULL; j = (j + 1) & mask) {
+		home = chunk_hash(game->chunks[j].x, game->chunks[j].y) & mask;
+		// the slot can move if its home is not (cyclically) in (i, j]
+		if (i <= j ? home <= i || home > j : home <= i && home > j) {
+			game->chunks[i] = game->chunks[j];
+			i = j;
+		}
 	}
 
-	// left top
-	if (c->neighbors[NPOS(-1, -1)] &&
-		ISSET(FIELD_UNCOVERED,
-			  c->neighbors[NPOS(-1, -1)]->fields[POS(CHUNK_POS_MAX, CHUNK_POS_MAX)]) &&
-		field_get_mines(c->neighbors[NPOS(-1, -1)], CHUNK_POS_MAX, CHUNK_POS_MAX) == 0) {
-		uncover_field_inbounds_recalculate(c, 0, 0);
+	game->chunks[i].c = NULL;
+	game->chunks_count--;
+
+	if (c->mines != NULL) {
+		arena_release(&game->mines_arena, c->mines);
 	}
-	// right top
-	if (c->neighbors[NPOS(1, -1)] &&
-		ISSET(FIELD_UNCOVERED, c->neighbors[NPOS(1, -1)]->fields[POS(0, CHUNK_POS_MAX)]) &&
-		field_get_mines(c->neighbors[NPOS(1, -1)], 0, CHUNK_POS_MAX) == 0) {
-		uncover_field_inbounds_recalculate(c, CHUNK_POS_MAX, 0);
+	if (c->fields != NULL) {
+		arena_release(&game->fields_arena, c->fields);
 	}
-	// left bottom
-	if (c->neighbors[NPOS(-1, 1)] &&
-		ISSET(FIELD_UNCOVERED, c->neighbors[NPOS(-1, 1)]->fields[POS(CHUNK_POS_MAX, 0)]) &&
-		field_get_mines(c->neighbors[NPOS(-1, 1)], CHUNK_POS_MAX, 0) == 0) {
-		uncover_field_inbounds_recalculate(c, 0, CHUNK_POS_MAX);
+
+	for (n = 0; n < 9; n++) {
+		if (c->neighbors[n] != NULL) {
+			// NPOS(-x, -y) == 8 - NPOS(x, y)
+			c->neighbors[n]->neighbors[8 - n] = NULL;
+		}
 	}
-	// right bottom
-	if (c->neighbors[NPOS(1, 1)] &&
-		ISSET(FIELD_UNCOVERED, c->neighbors[NPOS(1, 1)]->fields[POS(0, 0)]) &&
-		field_get_mines(c->neighbors[NPOS(1, 1)], 0, 0) == 0) {
-		uncover_field_inbounds_recalculate(c, CHUNK_POS_MAX, CHUNK_POS_MAX);
+
+	block = get_chunk_block(c);
+	x = c->x & ~CHUNK_BLOCK_MASK;
+	y = c->y & ~CHUNK_BLOCK_MASK;
+
+	for (n = 0; n < CHUNK_BLOCK_SIZE * CHUNK_BLOCK_SIZE; n++) {
+		if (find_chunk(game, x + (n & CHUNK_BLOCK_MASK), y + (n >> CHUNK_BLOCK_2LOG)) ==
+			&block->chunks[n]) {
+			return;
+		}
 	}
-	for (i = 0; i < CHUNK_SIZE; i++) {
-		// top
-		if (c->neighbors[NPOS(0, -1)] &&
-			ISSET(FIELD_UNCOVERED, c->neighbors[NPOS(0, -1)]->fields[POS(i, CHUNK_POS_MAX)]) &&
-			field_get_mines(c->neighbors[NPOS(0, -1)], i, CHUNK_POS_MAX) == 0) {
-			uncover_field_inbounds_recalculate(c, i, 0);
+
+	arena_release(&game->chunk_arena, block);
+}
+
+static void uncover_field_inbounds_recalculate(struct game *game, struct chunk *c, uint32_t x,
+											   uint32_t y);
+
+static void run_fill(struct game *game);
+
+static void push_fill(struct game *game, struct chunk *c, const uint16_t pos);
+
+// Records that the fill stopped at the edge fields in bits of c because the neighbor at ox, oy is
+// not visible, the fields are filled again when that neighbor becomes visible. Bit i is field i of
+// the edge next to the neighbor, bit 0 for corners. The neighbor must exist.
+static void push_frontier(struct chunk *c, const uint64_t bits, const int32_t ox,
+						  const int32_t oy) {
+	struct chunk *n;
+
+	n = c->neighbors[NPOS(ox, oy)];
+	n->frontier[NPOS(-ox, -oy)] |= bits;
+	SET(CHUNK_HIT, n->flags);
+}
+
+// Records that the mines around edge field x, y of c could not be counted, it is filled again when
+// c or one of the neighbors next to it that are not visible becomes visible
+static void push_frontiers(struct game *game, struct chunk *c, const uint32_t x, const uint32_t y) {
+	struct chunk *n;
+	int32_t ox, oy;
+
+	for (oy = -1; oy <= 1; oy++) {
+		for (ox = -1; ox <= 1; ox++) {
+			if ((ox == 0 && oy == 0) || (ox == -1 && x != 0) || (ox == 1 && x != CHUNK_POS_MAX) ||
+				(oy == -1 && y != 0) || (oy == 1 && y != CHUNK_POS_MAX)) {
+				continue;
+			}
+
+			// field_get_mines stops at the first neighbor that is not visible, the others may not
+			// exist yet
+			n = c->neighbors[NPOS(ox, oy)];
+			if (n == NULL) {
+				n = get_chunk_by_pos(game, c->x + ox, c->y + oy, true);
+			}
+
+			// a visible neighbor would push the field to its frontier again and again
+			if (!is_visible(game, n)) {
+				push_frontier(c, (uint64_t)1 << (ox == 0 ? x : oy == 0 ? y : 0), ox, oy);
+			}
 		}
-		// left
-		if (c->neighbors[NPOS(-1, 0)] &&
-			ISSET(FIELD_UNCOVERED, c->neighbors[NPOS(-1, 0)]->fields[POS(CHUNK_POS_MAX, i)]) &&
-			field_get_mines(c->neighbors[NPOS(-1, 0)], CHUNK_POS_MAX, i) == 0) {
-			uncover_field_inbounds_recalculate(c, 0, i);
+	}
+
+	if (y == 0) {
+		c->uncounted[FRONTIER_TOP] |= (uint64_t)1 << x;
+	} else if (y == CHUNK_POS_MAX) {
+		c->uncounted[FRONTIER_BOTTOM] |= (uint64_t)1 << x;
+	} else if (x == 0) {
+		c->uncounted[FRONTIER_LEFT] |= (uint64_t)1 << y;
+	} else {
+		c->uncounted[FRONTIER_RIGHT] |= (uint64_t)1 << y;
+	}
+	SET(CHUNK_HIT, c->flags);
+}
+
+// Fills again from the fields in the frontier of c, fields that stop again are pushed to a frontier
+// again
+static void resume_covered_fields(struct game *game, struct chunk *c) {
+	uint64_t frontier[9], uncounted[4], bits;
+	struct chunk *n;
+	int32_t ox, oy;
+	uint32_t d, i;
+
+	memcpy(frontier, c->frontier, sizeof(frontier));
+	memcpy(uncounted, c->uncounted, sizeof(uncounted));
+	memset(c->frontier, 0, sizeof(c->frontier));
+	memset(c->uncounted, 0, sizeof(c->uncounted));
+
+	for (d = 0; d < 9; d++) {
+		if (frontier[d] == 0) {
+			continue;
 		}
-		// right
-		if (c->neighbors[NPOS(1, 0)] &&
-			ISSET(FIELD_UNCOVERED, c->neighbors[NPOS(1, 0)]->fields[POS(0, i)]) &&
-			field_get_mines(c->neighbors[NPOS(1, 0)], 0, i) == 0) {
-			uncover_field_inbounds_recalculate(c, CHUNK_POS_MAX, i);
+
+		ox = (int32_t)(d % 3) - 1;
+		oy = (int32_t)(d / 3) - 1;
+
+		// evicted and saved neighbors are not linked, they are loaded again with the fields the
+		// fill stopped at
+		n = c->neighbors[d];
+		if (n == NULL) {
+			n = get_chunk_by_pos(game, c->x + ox, c->y + oy, true);
 		}
-		// bottom
-		if (c->neighbors[NPOS(0, 1)] &&
-			ISSET(FIELD_UNCOVERED, c->neighbors[NPOS(0, 1)]->fields[POS(i, 0)]) &&
-			field_get_mines(c->neighbors[NPOS(0, 1)], i, 0) == 0) {
-			uncover_field_inbounds_recalculate(c, i, CHUNK_POS_MAX);
+
+		// field i of the edge of n next to c, the corner for diagonal neighbors
+		for (bits = frontier[d]; bits != 0; bits &= bits - 1) {
+			i = __builtin_ctzll(bits);
+			push_fill(game, n, POS(ox == -1 ? CHUNK_POS_MAX : ox == 1 ? 0 : i,
+								   oy == -1 ? CHUNK_POS_MAX : oy == 1 ? 0 : i));
 		}
 	}
+
+	for (bits = uncounted[FRONTIER_TOP]; bits != 0; bits &= bits - 1) {
+		push_fill(game, c, POS(__builtin_ctzll(bits), 0));
+	}
+	for (bits = uncounted[FRONTIER_BOTTOM]; bits != 0; bits &= bits - 1) {
+		push_fill(game, c, POS(__builtin_ctzll(bits), CHUNK_POS_MAX));
+	}
+	for (bits = uncounted[FRONTIER_LEFT]; bits != 0; bits &= bits - 1) {
+		push_fill(game, c, POS(0, __builtin_ctzll(bits)));
+	}
+	for (bits = uncounted[FRONTIER_RIGHT]; bits != 0; bits &= bits - 1) {
+		push_fill(game, c, POS(CHUNK_POS_MAX, __builtin_ctzll(bits)));
+	}
+
+	run_fill(game);
+}
+
+// Returns whether c is visible (see visibility_hook). The covered fields of a chunk a flood fill
+// stopped at (CHUNK_HIT) are checked when it becomes visible, so the fill continues there.
+bool is_visible(struct game *game, struct chunk *c) {
+	if (game->visibility == NULL || !game->visibility(c, game->visibility_data)) {
+		return false;
+	}
+
+	if (ISSET(CHUNK_HIT, c->flags)) {
+		UNSET(CHUNK_HIT, c->flags);
+
+		check_covered_fields(game, c);
+	}
+
+	return true;
 }
 
-void populate_chunk(struct chunk *c) {
-	uint32_t x, y, state;
+void check_covered_fields(struct game *game, struct chunk *c) {
+	struct chunk **new_checks;
+	uint32_t size;
 
-	if (ISSET(CHUNK_POPULATED, c->flags)) {
+	if (game->dead) {
 		return;
 	}
 
-	state = c->seed;
+	// the edges of a chunk that becomes visible while a fill is running are checked after the fill,
+	// otherwise the result would depend on the order the fill visits the fields in
+	if (game->filling) {
+		if (game->fill_checks_count >= game->fill_checks_size) {
+			size = game->fill_checks_size ? game->fill_checks_size * 2 : FILL_QUEUE_SIZE;
+			new_checks = realloc(game->fill_checks, sizeof(*game->fill_checks) * size);
 
-	for (y = 0; y < CHUNK_SIZE; y++) {
-		for (x = 0; x < CHUNK_SIZE; x++) {
-			state = xorshift32(state);
-			if (state > game->mine_threshold) {
-				SET(FIELD_MINE, c->fields[POS(x, y)]);
+			if (new_checks == NULL) {
+				handle_alloc_error();
+			}
+
+			game->fill_checks = new_checks;
+			game->fill_checks_size = size;
+		}
+
+		game->fill_checks[game->fill_checks_count++] = c;
+		return;
+	}
+
+	TRACE_BEGIN(start);
+	resume_covered_fields(game, c);
+	TRACE_END(start, "check_covered_fields", "x", c->x, "y", c->y);
+}
+
+// The mines of a chunk are the xorshift32 stream of its seed, one state per field. The stream is
+// split into POPULATE_LANES parts of POPULATE_LANE_ROWS rows each which are generated side by side
+// in the lanes of a vector, the compiler maps it to SSE2, AVX2 or wasm simd128 registers.
+#define POPULATE_LANES 8
+#define POPULATE_LANE_STEPS (CHUNK_SIZE * CHUNK_SIZE / POPULATE_LANES)
+#define POPULATE_LANE_ROWS (POPULATE_LANE_STEPS / CHUNK_SIZE)
+
+typedef uint32_t populate_vec __attribute__((vector_size(POPULATE_LANES * sizeof(uint32_t))));
+
+// 1 in the lanes where state > threshold, the borrow out of threshold - state. SSE2 and AVX2 have
+// no unsigned vector compare, this only needs logic ops, a subtraction and a shift.
+#define POPULATE_ABOVE(state, threshold)                                                           \
+	(((~(threshold) & (state)) | (~((threshold) ^ (state)) & ((threshold) - (state)))) >> 31)
+
+// xorshift32 is linear over GF(2), so the state n steps after seed is the xor of the states n steps
+// after each set bit of seed. populate_jumps[i][k] is the state k * POPULATE_LANE_STEPS steps after
+// 1 << i.
+static populate_vec populate_jumps[32];
+
+// computed when the program starts, before any thread populates chunks
+__attribute__((constructor)) static void init_populate_jumps() {
+	uint32_t i, k, n, state;
+
+	for (i = 0; i < 32; i++) {
+		state = (uint32_t)1 << i;
+		for (k = 0; k < POPULATE_LANES; k++) {
+			populate_jumps[i][k] = state;
+			for (n = 0; n < POPULATE_LANE_STEPS; n++) {
+				state = xorshift32(state);
 			}
 		}
 	}
+}
+
+// Generates the mines of the chunk with seed to mines, the clones are picked at load time by the
+// CPU, the vector code is the same
+#if defined(__x86_64__) && !defined(__clang__)
+__attribute__((target_clones("avx2", "default")))
+#endif
+static void generate_mines(struct game *game, const uint32_t seed, uint64_t mines[CHUNK_SIZE]) {
+	populate_vec state, lo, hi, threshold;
+	uint32_t i, x, y;
+
+	// jump every lane to the start of its part of the stream
+	state = (populate_vec){0};
+	for (i = 0; i < 32; i++) {
+		if (seed >> i & 1) {
+			state ^= populate_jumps[i];
+		}
+	}
+
+	threshold = (populate_vec){0} + game->mine_threshold;
+
+	for (y = 0; y < POPULATE_LANE_ROWS; y++) {
+		lo = hi = (populate_vec){0};
+
+		for (x = 0; x < 32; x++) {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			lo |= POPULATE_ABOVE(state, threshold) << x;
+		}
+
+		for (x = 0; x < 32; x++) {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			hi |= POPULATE_ABOVE(state, threshold) << x;
+		}
+
+		for (i = 0; i < POPULATE_LANES; i++) {
+			mines[i * POPULATE_LANE_ROWS + y] = (uint64_t)hi[i] << 32 | lo[i];
+		}
+	}
+}
+
+// Gives c its mines, a chunk is only populated when mines of it are counted or its fields are
+// needed. The mines of chunks the view is about to reach may be ready from the prefetch worker.
+void populate_chunk(struct game *game, struct chunk *c) {
+	if (ISSET(CHUNK_POPULATED, c->flags)) {
+		return;
+	}
+
+	if (c->mines == NULL) {
+		c->mines = arena_alloc(&game->mines_arena);
+	}
+
+	if (take_prefetched_mines(game, c)) {
+		STAT_ADD(STAT_CHUNKS_PREFETCHED, 1);
+	} else {
+		STAT_ADD(STAT_CHUNKS_POPULATED, 1);
+
+		TRACE_BEGIN(start);
+		generate_mines(game, c->seed, c->mines);
+		TRACE_END(start, "populate_chunk", "x", c->x, "y", c->y);
+	}
 
 	SET(CHUNK_POPULATED, c->flags);
 }
 
-static int correct_pos(struct chunk **c, int32_t *x, int32_t *y);
+// Sets fields to the mines of the bitboard mines, without any other bits
+static void spread_mines(const uint64_t mines[CHUNK_SIZE], uint8_t *fields) {
+	uint64_t spread, bytes;
+	uint32_t i;
+
+	// spread 8 bits of the bitboard to 8 fields at once (little endian), byte k of spread has its
+	// high bit set if bit k is set
+	for (i = 0; i < CHUNK_SIZE * CHUNK_SIZE / 8; i++) {
+		spread = (mines[i / 8] >> i % 8 * 8 & 0xff) * 0x0101010101010101 & 0x8040201008040201;
+		spread = ((spread & 0x7f7f7f7f7f7f7f7f) + 0x7f7f7f7f7f7f7f7f) | spread;
+		spread &= 0x8080808080808080;
+
+		bytes = (spread >> 7) * FIELD_MINE;
+		memcpy(&fields[i * 8], &bytes, sizeof(bytes));
+	}
+}
 
-int is_mine(struct chunk *c, int32_t x, int32_t y) {
-	if (correct_pos(&c, &x, &y)) {
-		return -1;
+// Gives c its fields, all covered and with the mines of c, when a field of c is uncovered, flagged
+// or shows its mine count
+void expand_chunk(struct game *game, struct chunk *c) {
+	if (c->fields != NULL) {
+		return;
 	}
 
-	populate_chunk(c);
+	populate_chunk(game, c);
+	c->fields = arena_alloc(&game->fields_arena);
 
-	return ISSET(FIELD_MINE, c->fields[POS(x, y)]);
+	// the worker counted the fields that do not need the neighbors already
+	if (take_prefetched_fields(game, c)) {
+		c->counted = BIT(NPOS(0, 0));
+		return;
+	}
+
+	spread_mines(c->mines, c->fields);
 }
 
-struct chunk *get_neighbor(struct chunk *c, const int32_t x, const int32_t y) {
+struct chunk *get_neighbor(struct game *game, struct chunk *c, const int32_t x, const int32_t y) {
 	struct chunk *n;
 
 	if (c->neighbors[NPOS(x, y)] == NULL) {
-		n = create_chunk(c->x + x, c->y + y);
+		n = create_chunk(game, c->x + x, c->y + y);
 	} else {
 		n = c->neighbors[NPOS(x, y)];
 	}
 
+	// chunks next to rendered chunks count as used too, so they are not evicted
+	c->used = n->used = game->tick;
+
 	// if (c->neighbors[NPOS(x, y)] == NULL) {
 	// 	printf("BUG: neighbor %d,%d not linked to %d,%d\n", c->x + x, c->y + y, c->x, c->y);
 	// }
 
-	if (!is_visible(c) && !is_visible(n)) {
-		SET(CHUNK_HIT, n->flags);
+	if (!is_visible(game, c) && !is_visible(game, n)) {
 		return NULL;
 	}
 
 	return n;
 }
 
-static int correct_pos(struct chunk **c, int32_t *x, int32_t *y) {
-	struct chunk *n;
-	int32_t ox, oy;
+// Sets valid[y] to the fields of row y whose mine count can be computed with the neighbors in dirs
+// (bit NPOS(x, y) is set for every neighbor), the count of the other fields needs a neighbor that
+// is not in dirs. Without NPOS(0, 0) in dirs nothing is valid.
+static void countable_fields(const uint16_t dirs, uint64_t valid[CHUNK_SIZE]) {
+	const uint64_t first = 1, last = (uint64_t)1 << CHUNK_POS_MAX;
+	uint32_t y;
 
-	ox = *x >> CHUNK_SIZE_2LOG;
-	oy = *y >> CHUNK_SIZE_2LOG;
+	for (y = 0; y < CHUNK_SIZE; y++) {
+		valid[y] = ISSET(BIT(NPOS(0, 0)), dirs) ? -1 : 0;
+		if (!ISSET(BIT(NPOS(-1, 0)), dirs)) {
+			valid[y] &= ~first;
+		}
+		if (!ISSET(BIT(NPOS(1, 0)), dirs)) {
+			valid[y] &= ~last;
+		}
+	}
 
-	if (ox != 0 || oy != 0) {
-		n = get_neighbor(*c, ox, oy);
+	if (!ISSET(BIT(NPOS(0, -1)), dirs)) {
+		valid[0] = 0;
+	}
+	if (!ISSET(BIT(NPOS(0, 1)), dirs)) {
+		valid[CHUNK_POS_MAX] = 0;
+	}
+	if (!ISSET(BIT(NPOS(-1, -1)), dirs)) {
+		valid[0] &= ~first;
+	}
+	if (!ISSET(BIT(NPOS(1, -1)), dirs)) {
+		valid[0] &= ~last;
+	}
+	if (!ISSET(BIT(NPOS(-1, 1)), dirs)) {
+		valid[CHUNK_POS_MAX] &= ~first;
+	}
+	if (!ISSET(BIT(NPOS(1, 1)), dirs)) {
+		valid[CHUNK_POS_MAX] &= ~last;
+	}
+}
 
-		if (n == NULL) {
-			return 1;
+// Adds one bit to every column of the 4 bit counters in p0 (least significant) to p3
+#define ADD_BIT(a)                                                                                 \
+	do {                                                                                           \
+		carry0 = p0 & (a);                                                                         \
+		p0 ^= (a);                                                                                 \
+		carry1 = p1 & carry0;                                                                      \
+		p1 ^= carry0;                                                                              \
+		p3 |= p2 & carry1;                                                                         \
+		p2 ^= carry1;                                                                              \
+	} while (0)
+
+// Counts the mines around every field of c at once from the mine bitboards and caches the counts.
+// Each row of the chunk is one uint64_t, the 8 neighbors of all fields in a row are added with
+// shifted rows, bit sliced into 4 bit planes. Rows and columns outside of c come from the
+// neighbors, fields that need a NULL neighbor are not cached. Only fields that were not countable
+// in an earlier call are written, so counting a chunk edge by edge stays cheap.
+static void count_chunk_mines(struct game *game, struct chunk *c, struct chunk *const resolved[9]) {
+	// row y of c is index y + 1, the rows above and below come from the neighbors
+	uint64_t middle[CHUNK_SIZE + 2], left[CHUNK_SIZE + 2], right[CHUNK_SIZE + 2];
+	uint64_t planes[4][CHUNK_SIZE], valid[CHUNK_SIZE], counted[CHUNK_SIZE];
+	uint64_t p0, p1, p2, p3, carry0, carry1, w, e, todo;
+	const struct chunk *neighbors[9], *row_chunk, *west, *east;
+	uint32_t i, x, y, src_y;
+	uint16_t dirs;
+	int32_t oy;
+
+	// neighbors resolved by an earlier call are still there, only their fields were counted already
+	dirs = BIT(NPOS(0, 0));
+	for (i = 0; i < 9; i++) {
+		neighbors[i] = resolved[i];
+		if (neighbors[i] == NULL && ISSET(BIT(i), c->counted)) {
+			neighbors[i] = c->neighbors[i];
+			// the neighbor may have been evicted and created again since
+			if (neighbors[i] != NULL) {
+				populate_chunk(game, c->neighbors[i]);
+			}
+		}
+		if (neighbors[i] != NULL) {
+			SET(BIT(i), dirs);
 		}
+	}
+
+	for (i = 0; i < CHUNK_SIZE + 2; i++) {
+		oy = i == 0 ? -1 : i == CHUNK_SIZE + 1 ? 1 : 0;
+		src_y = (i - 1) & CHUNK_POS_MAX;
+
+		row_chunk = oy == 0 ? c : neighbors[NPOS(0, oy)];
+		west = neighbors[NPOS(-1, oy)];
+		east = neighbors[NPOS(1, oy)];
+
+		middle[i] = row_chunk ? row_chunk->mines[src_y] : 0;
+		w = west ? west->mines[src_y] >> CHUNK_POS_MAX : 0;
+		e = east ? east->mines[src_y] & 1 : 0;
+
+		// bit x of left is the field left of x, of right the field right of it
+		left[i] = middle[i] << 1 | w;
+		right[i] = middle[i] >> 1 | e << CHUNK_POS_MAX;
+	}
+
+	// no dependencies between rows, so the compiler can vectorize this
+	for (y = 0; y < CHUNK_SIZE; y++) {
+		p0 = p1 = p2 = p3 = 0;
+
+		ADD_BIT(left[y]);
+		ADD_BIT(middle[y]);
+		ADD_BIT(right[y]);
+		ADD_BIT(left[y + 1]);
+		ADD_BIT(right[y + 1]);
+		ADD_BIT(left[y + 2]);
+		ADD_BIT(middle[y + 2]);
+		ADD_BIT(right[y + 2]);
+
+		planes[0][y] = p0;
+		planes[1][y] = p1;
+		planes[2][y] = p2;
+		planes[3][y] = p3;
+	}
+
+	countable_fields(dirs, valid);
+	countable_fields(c->counted, counted);
 
-		*c = n;
-		*x += ox * -CHUNK_SIZE;
-		*y += oy * -CHUNK_SIZE;
+	for (y = 0; y < CHUNK_SIZE; y++) {
+		todo = valid[y] & ~counted[y];
+		while (todo) {
+			x = __builtin_ctzll(todo);
+			todo &= todo - 1;
+
+			c->fields[POS(x, y)] =
+				(c->fields[POS(x, y)] & ~FIELD_MINE_CACHE_MASK) | FIELD_MINE_COUNT_CACHED |
+				(planes[0][y] >> x & 1) | (planes[1][y] >> x & 1) << 1 |
+				(planes[2][y] >> x & 1) << 2 | (planes[3][y] >> x & 1) << 3;
+		}
 	}
 
-	return 0;
+	c->counted = dirs;
+}
+
+// Generates the mines of chunk x, y to mines and the fields expand_chunk makes of them to fields,
+// with the mine counts of the fields that do not need the neighbors. This only reads the seed and
+// the mine threshold of the game, so the prefetch worker can prepare chunks while the main thread
+// plays.
+void prepare_chunk(struct game *game, const uint32_t x, const uint32_t y,
+				   uint64_t mines[CHUNK_SIZE], uint8_t fields[CHUNK_SIZE * CHUNK_SIZE]) {
+	struct chunk *const resolved[9] = {NULL};
+	struct chunk c;
+
+	TRACE_BEGIN(start);
+
+	// not populate_chunk and expand_chunk, the counters and arenas belong to the main thread. c is
+	// in no table and has no neighbors, counting it only reads its own mines.
+	generate_mines(game, chunk_seed(game, x, y), mines);
+	spread_mines(mines, fields);
+
+	memset(&c, 0, sizeof(c));
+	c.mines = mines;
+	c.fields = fields;
+	count_chunk_mines(game, &c, resolved);
+
+	TRACE_END(start, "prepare_chunk", "x", x, "y", y);
 }
 
-int field_get_mines(struct chunk *c, const uint32_t x, const uint32_t y) {
-	int m, mines, i, j;
+int field_get_mines(struct game *game, struct chunk *c, const uint32_t x, const uint32_t y) {
+	struct chunk *neighbors[9] = {NULL};
+	int32_t ox, oy, i;
 
-	populate_chunk(c);
+	// the count is cached in the field
+	expand_chunk(game, c);
+	c->used = game->tick;
 
 	if (ISSET(FIELD_MINE_COUNT_CACHED, c->fields[POS(x, y)])) {
+		STAT_ADD(STAT_MINES_HITS, 1);
 		return c->fields[POS(x, y)] & FIELD_MINE_CACHE_MASK;
 	}
 
-	mines = 0;
+	STAT_ADD(STAT_MINES_MISSES, 1);
 
-	for (i = -1; i <= 1; i++) {
-		for (j = -1; j <= 1; j++) {
-			if (i == 0 && j == 0) {
-				continue;
-			}
-			m = is_mine(c, x + j, y + i);
-			if (m == -1) {
-				return -1;
-			} else if (m) {
-				mines++;
-			}
+	// resolve only the neighbors this field needs, in the order it would look at them, the other
+	// neighbors may not be created or visible
+	for (i = 0; i < 9; i++) {
+		ox = i % 3 - 1;
+		oy = i / 3 - 1;
+
+		if ((ox == 0 && oy == 0) || (ox == -1 && x != 0) || (ox == 1 && x != CHUNK_POS_MAX) ||
+			(oy == -1 && y != 0) || (oy == 1 && y != CHUNK_POS_MAX)) {
+			continue;
 		}
+
+		neighbors[i] = get_neighbor(game, c, ox, oy);
+
+		if (neighbors[i] == NULL) {
+			return -1;
+		}
+
+		populate_chunk(game, neighbors[i]);
 	}
 
-	SET(FIELD_MINE_COUNT_CACHED | mines, c->fields[POS(x, y)]);
+	count_chunk_mines(game, c, neighbors);
 
-	return mines;
+	return c->fields[POS(x, y)] & FIELD_MINE_CACHE_MASK;
 }
 
-void uncover_field_inbounds(struct chunk *c, uint32_t x, uint32_t y) {
+void uncover_field_inbounds(struct game *game, struct chunk *c, uint32_t x, uint32_t y) {
 	if (game->dead) {
 		return;
 	}
 
+	expand_chunk(game, c);
+	c->used = game->tick;
+
 	if (ISSET(FIELD_UNCOVERED, c->fields[POS(x, y)])) {
 		return;
 	}
 
-	uncover_field_inbounds_recalculate(c, x, y);
+	// fills that continue later, when their chunks become visible, still count for this field
+	STAT_ADD(STAT_FILLS, 1);
+	STAT_SET(STAT_LAST_FILL_CELLS, 0);
+
+	uncover_field_inbounds_recalculate(game, c, x, y);
 }
 
-static void uncover_field(struct chunk *c, int32_t x, int32_t y) {
-	if (game->dead) {
+// Records that field x, y of c changed, for the chunk textures and the rectangles of the window
+// that the renderer draws again. Too many changed chunks redraw the whole window.
+static void mark_field_dirty(struct game *game, struct chunk *c, const uint32_t x,
+							 const uint32_t y) {
+	struct dirty_rect *r;
+	uint32_t i;
+
+	SET(CHUNK_CHANGED, c->flags);
+	queue_summary(game, c);
+
+	if (game->dirty) {
 		return;
 	}
 
-	if (correct_pos(&c, &x, &y)) {
-		return;
+	// the fields of one chunk usually change one after another
+	for (i = game->dirty_rects_count; i-- > 0;) {
+		r = &game->dirty_rects[i];
+		if (r->x == c->x && r->y == c->y) {
+			r->min_x = x < r->min_x ? x : r->min_x;
+			r->min_y = y < r->min_y ? y : r->min_y;
+			r->max_x = x > r->max_x ? x : r->max_x;
+			r->max_y = y > r->max_y ? y : r->max_y;
+			return;
+		}
 	}
 
-	if (ISSET(FIELD_UNCOVERED, c->fields[POS(x, y)])) {
+	if (game->dirty_rects_count == DIRTY_RECTS) {
+		game->dirty = true;
 		return;
 	}
 
-	uncover_field_inbounds_recalculate(c, x, y);
+	r = &game->dirty_rects[game->dirty_rects_count++];
+	r->x = c->x;
+	r->y = c->y;
+	r->min_x = r->max_x = x;
+	r->min_y = r->max_y = y;
+}
+
+static void push_fill(struct game *game, struct chunk *c, const uint16_t pos) {
+	struct fill_cell *new_queue;
+	uint32_t size;
+
+	if (game->fill_count >= game->fill_size) {
+		size = game->fill_size ? game->fill_size * 2 : FILL_QUEUE_SIZE;
+		new_queue = realloc(game->fill_queue, sizeof(*game->fill_queue) * size);
+
+		if (new_queue == NULL) {
+			handle_alloc_error();
+		}
+
+		game->fill_queue = new_queue;
+		game->fill_size = size;
+	}
+
+	game->fill_queue[game->fill_count].c = c;
+	game->fill_queue[game->fill_count].pos = pos;
+	game->fill_count++;
+}
+
+// counts n fields that the flood fill expanded
+static void count_fill_cells(struct game *game, const uint32_t n) {
+	STAT_ADD(STAT_FILL_CELLS, n);
+	STAT_ADD(STAT_LAST_FILL_CELLS, n);
 }
 
-static void uncover_field_inbounds_recalculate(struct chunk *c, uint32_t x, uint32_t y) {
-	int mines, i, j;
+// keeps the summary of c up to date, field x, y was just uncovered
+static void count_uncovered(struct chunk *c, const uint32_t x, const uint32_t y) {
+	c->tile[LOD_TILE_POS(x, y)]++;
+	c->uncovered_count++;
+}
+
+// count_uncovered for the fields in bits of row y, one block of the tile at a time
+static void count_uncovered_row(struct chunk *c, const uint32_t y, const uint64_t bits) {
+	const uint64_t block = ((uint64_t)1 << (1 << LOD_BLOCK_2LOG)) - 1;
+	uint32_t x;
+
+	for (x = 0; x < CHUNK_SIZE; x += 1 << LOD_BLOCK_2LOG) {
+		c->tile[LOD_TILE_POS(x, y)] += __builtin_popcountll(bits >> x & block);
+	}
+	c->uncovered_count += __builtin_popcountll(bits);
+}
 
+// Uncovers the field if it is not flagged and flood fills from it, the fill only continues past
+// fields without surrounding mines. While a fill is running the field is only queued.
+static void uncover_field_inbounds_recalculate(struct game *game, struct chunk *c, uint32_t x,
+											   uint32_t y) {
 	if (ISSET(FIELD_FLAG, c->fields[POS(x, y)])) {
 		return;
 	}
 
 	SET(FIELD_UNCOVERED, c->fields[POS(x, y)]);
+	count_uncovered(c, x, y);
+	mark_field_dirty(game, c, x, y);
 	if (ISSET(FIELD_MINE, c->fields[POS(x, y)])) {
 		game->dead = 1;
 		return;
 	}
 
-	mines = field_get_mines(c, x, y);
-	// useless. if mines != 0 it will do nothing anyway
-	// if (mines == -1) {
-	// 	 return;
-	// }
-	if (mines != 0) {
+	push_fill(game, c, POS(x, y));
+
+	run_fill(game);
+}
+
+// Marks a covered, unflagged field as uncovered and returns whether it has to be expanded.
+// Fields next to an expanded field (one without surrounding mines) can never be mines.
+static bool uncover_neighbor(struct chunk *c, const uint32_t x, const uint32_t y) {
+	if (ISSET(FIELD_UNCOVERED | FIELD_FLAG, c->fields[POS(x, y)])) {
+		return false;
+	}
+
+	SET(FIELD_UNCOVERED, c->fields[POS(x, y)]);
+	count_uncovered(c, x, y);
+
+	return true;
+}
+
+// Starts task t for the fill of c, without queued fields. Does what field_get_mines does before
+// counting, the threads of the pool must not create or populate chunks.
+static void start_fill_task(struct game *game, struct fill_task *t, struct chunk *c) {
+	uint32_t i;
+
+	t->c = c;
+	memset(t->queued, 0, sizeof(t->queued));
+	memset(t->expanded, 0, sizeof(t->expanded));
+	memset(t->uncounted, 0, sizeof(t->uncounted));
+	t->cells = 0;
+	t->min_x = t->min_y = CHUNK_POS_MAX;
+	t->max_x = t->max_y = 0;
+	t->changed = false;
+
+	expand_chunk(game, c);
+	c->used = game->tick;
+	for (i = 0; i < 9; i++) {
+		if (ISSET(BIT(i), c->counted) && c->neighbors[i] != NULL) {
+			populate_chunk(game, c->neighbors[i]);
+		}
+	}
+}
+
+// one in every byte
+#define BYTES_ONE 0x0101010101010101
+// multiplied with bytes of 0 or 1, the top byte has bit i set for byte i
+#define BYTES_PACK 0x0102040810204080
+
+_Static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "fields are read 8 at a time");
+
+// Reads row y of c as masks: the fields with a cached mine count of 0, the fields with a cached
+// mine count and the covered fields without a flag. Every 8 fields are one uint64_t, each
+// condition is turned into a 0 or 1 per byte and the bytes are packed with one multiplication.
+static void load_fill_row(const struct chunk *c, const uint32_t y, uint64_t *zero, uint64_t *cached,
+						  uint64_t *covered) {
+	uint64_t z = 0, k = 0, o = 0, v, count, counted, shown;
+	uint32_t x;
+
+	for (x = 0; x < CHUNK_SIZE; x += 8) {
+		memcpy(&v, &c->fields[POS(x, y)], sizeof(v));
+
+		counted = v >> __builtin_ctz(FIELD_MINE_COUNT_CACHED) & BYTES_ONE;
+		// the mine count is at most 8, adding 127 sets the top bit of a byte if it is not 0
+		count = ((v & BYTES_ONE * FIELD_MINE_CACHE_MASK) + BYTES_ONE * 0x7f) >> 7 & BYTES_ONE;
+		shown = (v >> __builtin_ctz(FIELD_UNCOVERED) | v >> __builtin_ctz(FIELD_FLAG)) & BYTES_ONE;
+
+		z |= ((counted & ~count) * BYTES_PACK >> 56) << x;
+		k |= (counted * BYTES_PACK >> 56) << x;
+		o |= ((shown ^ BYTES_ONE) * BYTES_PACK >> 56) << x;
+	}
+
+	*zero = z;
+	*cached = k;
+	*covered = o;
+}
+
+// Returns gen with the fields of run that are connected to it through fields of run in the same
+// row, in log2(CHUNK_SIZE) shifts in each direction
+static uint64_t fill_runs(const uint64_t gen, const uint64_t run) {
+	uint64_t left = gen, right = gen, left_run = run, right_run = run;
+	uint32_t shift;
+
+	for (shift = 1; shift < CHUNK_SIZE; shift <<= 1) {
+		left |= left_run & left << shift;
+		left_run &= left_run << shift;
+		right |= right_run & right >> shift;
+		right_run &= right_run >> shift;
+	}
+
+	return left | right;
+}
+
+// Grows the expanded fields of row y of task t by the runs of covered zero fields that are
+// connected to its queued zero fields or next to the expanded fields of the rows above and below,
+// returns whether they changed
+static bool grow_row(struct fill_task *t, const uint32_t y, const uint64_t zero,
+					 const uint64_t covered) {
+	uint64_t open, near, grown;
+
+	open = zero & covered;
+	near = (y > 0 ? t->expanded[y - 1] : 0) | (y < CHUNK_POS_MAX ? t->expanded[y + 1] : 0);
+	near = (near | near << 1 | near >> 1) & open;
+	grown = fill_runs(t->expanded[y] | (t->queued[y] & zero) | near, open);
+
+	if (grown == t->expanded[y]) {
+		return false;
+	}
+
+	t->expanded[y] = grown;
+	return true;
+}
+
+// Expands the queued fields of task t without leaving its chunk, with row masks instead of one
+// field at a time. A field without surrounding mines (zero) uncovers the 8 fields around it, the
+// zero fields it uncovers are expanded too. The expanded fields of a row are the runs of covered
+// zero fields connected to a queued zero field or to the expanded fields of the rows above and
+// below (see grow_row), the rows are swept down and up again until no row changes. The fields next
+// to the expanded ones are uncovered at the end. Rows are only read once the fill reaches them. The
+// mines around fields that are not on the edge only depend on the chunk and the neighbors it was
+// counted with before, which the main thread populated.
+static void fill_rows(struct game *game, struct fill_task *t) {
+	struct chunk *const none[9] = {NULL};
+	struct chunk *c = t->c;
+	uint64_t zero[CHUNK_SIZE], cached[CHUNK_SIZE], covered[CHUNK_SIZE];
+	uint64_t *expanded = t->expanded;
+	uint64_t near, uncovered, bits, columns;
+	uint32_t y, lo, hi;
+	bool changed;
+
+	if (!ISSET(BIT(NPOS(0, 0)), c->counted)) {
+		count_chunk_mines(game, c, none);
+	}
+
+	lo = CHUNK_SIZE;
+	hi = 0;
+	for (y = 0; y < CHUNK_SIZE; y++) {
+		if (t->queued[y] != 0) {
+			lo = y < lo ? y : lo;
+			hi = y;
+		}
+	}
+	if (lo > hi) {
 		return;
 	}
-	for (i = -1; i <= 1; i++) {
-		for (j = -1; j <= 1; j++) {
-			if (i == 0 && j == 0) {
-				continue;
+
+	for (y = lo; y <= hi; y++) {
+		load_fill_row(c, y, &zero[y], &cached[y], &covered[y]);
+	}
+
+	// every pass sweeps the rows down and up, a row next to the rows swept so far is added when the
+	// row on the border gets expanded fields
+	do {
+		changed = false;
+
+		for (y = lo; y <= hi; y++) {
+			if (grow_row(t, y, zero[y], covered[y])) {
+				changed = true;
+
+				if (y == lo && lo > 0) {
+					lo--;
+					load_fill_row(c, lo, &zero[lo], &cached[lo], &covered[lo]);
+				}
+				if (y == hi && hi < CHUNK_POS_MAX) {
+					hi++;
+					load_fill_row(c, hi, &zero[hi], &cached[hi], &covered[hi]);
+				}
+			}
+		}
+
+		for (y = hi + 1; y > lo;) {
+			y--;
+			if (grow_row(t, y, zero[y], covered[y])) {
+				changed = true;
+
+				if (y == lo && lo > 0) {
+					lo--;
+					load_fill_row(c, lo, &zero[lo], &cached[lo], &covered[lo]);
+				}
+				if (y == hi && hi < CHUNK_POS_MAX) {
+					hi++;
+					load_fill_row(c, hi, &zero[hi], &cached[hi], &covered[hi]);
+				}
+			}
+		}
+	} while (changed);
+
+	// expanded fields are only in rows lo to hi and so are the fields next to them, the rows on the
+	// border were added when they got expanded fields
+	columns = 0;
+	for (y = lo; y <= hi; y++) {
+		near = expanded[y] | (y > 0 ? expanded[y - 1] : 0) |
+			   (y < CHUNK_POS_MAX ? expanded[y + 1] : 0);
+		uncovered = (near | near << 1 | near >> 1) & covered[y];
+
+		// every queued or uncovered field is expanded once, if it has no surrounding mines
+		t->cells += __builtin_popcountll(t->queued[y] | uncovered);
+		t->uncounted[y] = (t->queued[y] | uncovered) & ~cached[y];
+
+		if (uncovered == 0) {
+			continue;
+		}
+
+		for (bits = uncovered; bits != 0; bits &= bits - 1) {
+			SET(FIELD_UNCOVERED, c->fields[POS(__builtin_ctzll(bits), y)]);
+		}
+		count_uncovered_row(c, y, uncovered);
+
+		t->min_y = y < t->min_y ? y : t->min_y;
+		t->max_y = y;
+		columns |= uncovered;
+	}
+
+	if (columns != 0) {
+		t->min_x = __builtin_ctzll(columns);
+		t->max_x = CHUNK_POS_MAX - __builtin_clzll(columns);
+		t->changed = true;
+	}
+}
+
+// Continues the fill from the expanded fields on edge of c in bits in the neighbor at ox, oy (bit i
+// is field i of the edge, bit 0 for corners): the fields of the neighbor next to them are uncovered
+// and queued, or the fields are added to the frontier when the neighbor is not visible
+static void spill_fill(struct game *game, struct chunk *c, const uint64_t bits, const int32_t ox,
+					   const int32_t oy) {
+	struct chunk *n;
+	uint64_t reach;
+	uint32_t i, x, y;
+
+	if (bits == 0) {
+		return;
+	}
+
+	n = get_neighbor(game, c, ox, oy);
+	if (n == NULL) {
+		push_frontier(c, bits, ox, oy);
+		return;
+	}
+
+	expand_chunk(game, n);
+
+	// the fields of a side reach one field further on both ends, those belong to the corners
+	reach = ox != 0 && oy != 0 ? 1 : bits | bits << 1 | bits >> 1;
+
+	for (; reach != 0; reach &= reach - 1) {
+		i = __builtin_ctzll(reach);
+		x = ox == -1 ? CHUNK_POS_MAX : ox == 1 ? 0 : i;
+		y = oy == -1 ? CHUNK_POS_MAX : oy == 1 ? 0 : i;
+
+		if (uncover_neighbor(n, x, y)) {
+			mark_field_dirty(game, n, x, y);
+			push_fill(game, n, POS(x, y));
+		}
+	}
+}
+
+// Does the part of task t that needs other chunks on the main thread: counting the edge fields that
+// need the neighbors and continuing the fill in the neighbors, the fields that end up uncovered and
+// the frontiers do not depend on the order of the tasks
+static void finish_fill_task(struct game *game, struct fill_task *t) {
+	struct chunk *c;
+	uint64_t bits, top, bottom, left, right;
+	uint32_t x, y;
+	int mines;
+
+	c = t->c;
+
+	if (t->changed) {
+		mark_field_dirty(game, c, t->min_x, t->min_y);
+		mark_field_dirty(game, c, t->max_x, t->max_y);
+	}
+
+	count_fill_cells(game, t->cells);
+
+	for (y = 0; y < CHUNK_SIZE; y++) {
+		for (bits = t->uncounted[y]; bits != 0; bits &= bits - 1) {
+			x = __builtin_ctzll(bits);
+
+			mines = field_get_mines(game, c, x, y);
+			if (mines == -1) {
+				push_frontiers(game, c, x, y);
+			} else if (mines == 0) {
+				// counted now, the next task of c expands it
+				push_fill(game, c, POS(x, y));
+			}
+		}
+	}
+
+	// bit i of each side is field i of that edge
+	top = t->expanded[0];
+	bottom = t->expanded[CHUNK_POS_MAX];
+	left = right = 0;
+	for (y = 0; y < CHUNK_SIZE; y++) {
+		left |= (t->expanded[y] & 1) << y;
+		right |= (t->expanded[y] >> CHUNK_POS_MAX) << y;
+	}
+
+	spill_fill(game, c, top, 0, -1);
+	spill_fill(game, c, bottom, 0, 1);
+	spill_fill(game, c, left, -1, 0);
+	spill_fill(game, c, right, 1, 0);
+	spill_fill(game, c, top & 1, -1, -1);
+	spill_fill(game, c, top >> CHUNK_POS_MAX, 1, -1);
+	spill_fill(game, c, bottom & 1, -1, 1);
+	spill_fill(game, c, bottom >> CHUNK_POS_MAX, 1, 1);
+}
+
+// Expands all queued fields of chunk c in one task, fields in other chunks are pushed back to the
+// fill queue
+static void fill_chunk(struct game *game, struct chunk *c) {
+	struct fill_task t;
+	uint16_t pos;
+
+	start_fill_task(game, &t, c);
+
+	// the queued fields are usually grouped by chunk
+	while (game->fill_count > 0 && game->fill_queue[game->fill_count - 1].c == c) {
+		pos = game->fill_queue[--game->fill_count].pos;
+		t.queued[pos / CHUNK_SIZE] |= (uint64_t)1 << pos % CHUNK_SIZE;
+	}
+
+	fill_rows(game, &t);
+	finish_fill_task(game, &t);
+}
+
+// game and tasks of the round the pool runs
+static struct game *pool_game;
+static struct fill_task *pool_tasks;
+
+// runs task i on a thread of the pool
+static void run_fill_task(const uint32_t i) {
+	TRACE_BEGIN(start);
+
+	fill_rows(pool_game, &pool_tasks[i]);
+
+	TRACE_END(start, "fill_task", "x", pool_tasks[i].c->x, "y", pool_tasks[i].c->y);
+}
+
+// Runs the flood fill in rounds. Each round the queued fields are grouped by chunk and every chunk
+// is expanded on its own by the threads of the pool. Everything that needs other chunks, resolving
+// and creating neighbors, counting edge fields and uncovering fields in the neighbors, is done by
+// the main thread between the rounds in the same way fill_chunk does it, so the fields that end up
+// uncovered and the frontiers are the same as the ones of the serial fill. While another game uses
+// the pool the queue is left to the serial fill.
+static void run_parallel_fill(struct game *game) {
+	struct fill_task *new_tasks, *t;
+	struct chunk *c;
+	uint32_t i, tasks, size;
+	uint16_t pos;
+
+	if (!try_lock_pool()) {
+		return;
+	}
+
+	start_pool(game->fill_threads);
+
+	while (game->fill_count > 0) {
+		// the task of a chunk is found through the chunk, the queue is not sorted
+		tasks = 0;
+		for (i = 0; i < game->fill_count; i++) {
+			c = game->fill_queue[i].c;
+			pos = game->fill_queue[i].pos;
+
+			if (c->fill_task == 0) {
+				if (tasks >= game->fill_tasks_size) {
+					size = game->fill_tasks_size ? game->fill_tasks_size * 2 : 16;
+					new_tasks = realloc(game->fill_tasks, sizeof(*game->fill_tasks) * size);
+
+					if (new_tasks == NULL) {
+						handle_alloc_error();
+					}
+
+					game->fill_tasks = new_tasks;
+					game->fill_tasks_size = size;
+				}
+
+				start_fill_task(game, &game->fill_tasks[tasks++], c);
+				c->fill_task = tasks;
 			}
-			uncover_field(c, x + j, y + i);
+
+			t = &game->fill_tasks[c->fill_task - 1];
+			t->queued[pos / CHUNK_SIZE] |= (uint64_t)1 << pos % CHUNK_SIZE;
+		}
+
+		game->fill_count = 0;
+
+		pool_game = game;
+		pool_tasks = game->fill_tasks;
+		if (tasks == 1) {
+			run_fill_task(0);
+		} else {
+			run_pool(run_fill_task, tasks);
+		}
+
+		for (i = 0; i < tasks; i++) {
+			game->fill_tasks[i].c->fill_task = 0;
+			finish_fill_task(game, &game->fill_tasks[i]);
 		}
 	}
+
+	unlock_pool();
+}
+
+// Runs the flood fill until the fill queue is empty. Resolving a neighbor can call
+// check_covered_fields (see is_visible) while the fill is running, those chunks are checked after
+// it, each resumed field is filled completely before the next one is checked, as it was before the
+// fill was running.
+static void run_fill(struct game *game) {
+	if (game->filling) {
+		return;
+	}
+
+	game->filling = true;
+
+	TRACE_BEGIN(start);
+	TRACE_VALUE(queued, game->fill_count);
+	TRACE_VALUE(cells, STAT_GET(STAT_FILL_CELLS));
+
+	if (game->fill_threads > 1) {
+		run_parallel_fill(game);
+	}
+
+	while (game->fill_count > 0) {
+		fill_chunk(game, game->fill_queue[game->fill_count - 1].c);
+	}
+
+	game->filling = false;
+
+	// without counters (NO_STATS) cells is 0
+	TRACE_END(start, "flood_fill", "queued", queued, "cells", STAT_GET(STAT_FILL_CELLS) - cells);
+
+	while (game->fill_checks_count > 0) {
+		resume_covered_fields(game, game->fill_checks[--game->fill_checks_count]);
+	}
 }
 
-void field_toggle_flag(struct chunk *c, const uint32_t x, const uint32_t y) {
+void field_toggle_flag(struct game *game, struct chunk *c, const uint32_t x, const uint32_t y) {
 	if (game->dead) {
 		return;
 	}
 
+	expand_chunk(game, c);
+	c->used = game->tick;
+
 	if (!ISSET(FIELD_UNCOVERED, c->fields[POS(x, y)])) {
 		TOGGLE(FIELD_FLAG, c->fields[POS(x, y)]);
+		c->flags_count += ISSET(FIELD_FLAG, c->fields[POS(x, y)]) ? 1 : -1;
+		mark_field_dirty(game, c, x, y);
 	}
 }
@@ -1,22 +1,53 @@
 #ifndef CHUNK_H
 #define CHUNK_H
 
+#include "arena.h"
+
 #include <stdbool.h>
 #include <stdint.h>
 
 #define CHUNK_SIZE_2LOG 6
 #define CHUNK_SIZE (1 << CHUNK_SIZE_2LOG)
-#define CHUNK_LIST_SIZE 256
+
+// initial number of slots in the chunk hash table, must be a power of two
+#define CHUNK_TABLE_SIZE 256
+// initial number of entries in the flood fill queue
+#define FILL_QUEUE_SIZE 256
 #define CHUNK_POS_MAX (CHUNK_SIZE - 1)
+// chunks are allocated in blocks of 2x2 neighboring chunks, so chunks that are close in the game
+// are close in memory too
+#define CHUNK_BLOCK_2LOG 1
+#define CHUNK_BLOCK_SIZE (1 << CHUNK_BLOCK_2LOG)
+#define CHUNK_BLOCK_MASK (CHUNK_BLOCK_SIZE - 1)
 
 // Get chunk index from its x and y
 #define POS(x, y) ((x) + CHUNK_SIZE * (y))
+// Get the index of a chunk in its block from the chunk x and y
+#define CHUNK_BLOCK_POS(x, y) (((x)&CHUNK_BLOCK_MASK) + CHUNK_BLOCK_SIZE * ((y)&CHUNK_BLOCK_MASK))
+// zoomed out chunks are drawn as a tile of LOD_TILE_SIZE * LOD_TILE_SIZE blocks of fields
+#define LOD_TILE_2LOG 3
+#define LOD_TILE_SIZE (1 << LOD_TILE_2LOG)
+#define LOD_BLOCK_2LOG (CHUNK_SIZE_2LOG - LOD_TILE_2LOG)
+// Get the index in chunk->tile of the block of field x, y
+#define LOD_TILE_POS(x, y) (((x) >> LOD_BLOCK_2LOG) + LOD_TILE_SIZE * ((y) >> LOD_BLOCK_2LOG))
+
 // Get neightbor index from x and y, coordinates must be between -1 and 1, inclusive
 #define NPOS(x, y) ((x) + 3 * (y) + 4)
 
 // chunk flags
 #define CHUNK_POPULATED 0x01
+// the frontier of the chunk has to be resumed when it becomes visible
 #define CHUNK_HIT 0x02
+// fields changed since the renderer cached the image of the chunk
+#define CHUNK_CHANGED 0x04
+// the summary changed since it was added to the lod pyramid, the chunk is in game->lod_queue
+#define CHUNK_SUMMARY_CHANGED 0x08
+
+// edges of a chunk, for uncounted
+#define FRONTIER_TOP 0
+#define FRONTIER_BOTTOM 1
+#define FRONTIER_LEFT 2
+#define FRONTIER_RIGHT 3
 
 // field flags
 #define FIELD_MINE_CACHE_MASK 0x0f
@@ -25,25 +56,107 @@
 #define FIELD_FLAG 0x40
 #define FIELD_MINE_COUNT_CACHED 0x80
 
+// A chunk only has the parts of it that were needed so far. A chunk that was created to link it to
+// its neighbors has its position and seed, mines are added when a mine count needs them (see
+// populate_chunk) and fields when a field of the chunk is uncovered, flagged or shows its mine
+// count (see expand_chunk).
 struct chunk {
-	uint8_t fields[CHUNK_SIZE * CHUNK_SIZE];
+	// CHUNK_SIZE * CHUNK_SIZE fields from game->fields_arena, NULL for a chunk without fields, its
+	// fields are all covered. Every chunk of a block starts at a cache line.
+	_Alignas(CACHE_LINE_SIZE) uint8_t *fields;
+	// bit x of mines[y] is set if field x, y is a mine, CHUNK_SIZE rows from game->mines_arena,
+	// NULL before the chunk is populated
+	uint64_t *mines;
 	struct chunk *neighbors[9];
+	// Fields where flood fills stopped because this chunk was not visible, they are filled again
+	// when it becomes visible (see check_covered_fields). Bit i of frontier[NPOS(x, y)] is field i
+	// of the edge of the neighbor at x, y next to this chunk (bit 0 for corners). Bit i of
+	// uncounted[FRONTIER_*] is field i of that edge of this chunk, its mines could not be counted.
+	uint64_t frontier[9], uncounted[4];
+	// Summary for zooming out (see lod.c): the number of uncovered fields in each block of the tile
+	// and the number of uncovered and flagged fields of the chunk, kept up to date on every change.
+	uint8_t tile[LOD_TILE_SIZE * LOD_TILE_SIZE];
+	uint16_t uncovered_count, flags_count;
 	uint32_t x, y, seed;
+	// game->tick when the chunk was last used, old chunks are evicted first (see evict.c)
+	uint32_t used;
+	// neighbors (bit NPOS(x, y)) the mine counts in fields were computed with, see
+	// count_chunk_mines
+	uint16_t counted;
 	uint8_t flags;
+	// index + 1 of the task of this chunk in game->fill_tasks during a round of the parallel flood
+	// fill, 0 otherwise
+	uint32_t fill_task;
+};
+
+_Static_assert(CHUNK_SIZE == 64, "a row of mines must fit in an uint64_t");
+
+struct chunk_block {
+	struct chunk chunks[CHUNK_BLOCK_SIZE * CHUNK_BLOCK_SIZE];
+};
+
+// field queued for the flood fill, pos is the index in c->fields
+struct fill_cell {
+	struct chunk *c;
+	uint16_t pos;
+};
+
+// Fields of one chunk the flood fill expands at once, bit x of a row mask is field x of that row
+// (see fill_rows). This runs on the threads of the pool for the parallel flood fill, it only writes
+// the fields of c. Fields on the edge of c that need a neighbor are left to the main thread.
+struct fill_task {
+	struct chunk *c;
+	// the fields to expand, every field is expanded at most once
+	uint64_t queued[CHUNK_SIZE];
+	// fields without surrounding mines, the fill continues in the neighbors from the ones on the
+	// edge, and edge fields whose mines could not be counted without the neighbors
+	uint64_t expanded[CHUNK_SIZE], uncounted[CHUNK_SIZE];
+	// fields the task expanded
+	uint32_t cells;
+	// fields uncovered by the task
+	uint8_t min_x, min_y, max_x, max_y;
+	bool changed;
 };
 
-void alloc_chunk_list(const uint32_t size);
+// slot in the chunk hash table, c is NULL for empty slots
+struct chunk_slot {
+	uint32_t x, y;
+	struct chunk *c;
+};
+
+uint32_t chunk_hash(const uint32_t x, const uint32_t y);
+
+// see game.h
+struct game;
+
+void alloc_chunk_table(struct game *game, const uint32_t size);
+
+uint32_t chunk_seed(struct game *game, const uint32_t x, const uint32_t y);
+
+void populate_chunk(struct game *game, struct chunk *c);
+
+void expand_chunk(struct game *game, struct chunk *c);
+
+void prepare_chunk(struct game *game, const uint32_t x, const uint32_t y,
+				   uint64_t mines[CHUNK_SIZE], uint8_t fields[CHUNK_SIZE * CHUNK_SIZE]);
+
+struct chunk *find_chunk(struct game *game, const uint32_t x, const uint32_t y);
+
+struct chunk *get_chunk_by_pos(struct game *game, const uint32_t x, const uint32_t y,
+							   const bool create);
+
+void evict_chunk(struct game *game, struct chunk *c);
 
-struct chunk *get_chunk_by_pos(const uint32_t x, const uint32_t y, const bool create);
+bool is_visible(struct game *game, struct chunk *c);
 
-void check_covered_fields(struct chunk *c);
+void check_covered_fields(struct game *game, struct chunk *c);
 
-struct chunk *get_neighbor(struct chunk *c, const int32_t x, const int32_t y);
+struct chunk *get_neighbor(struct game *game, struct chunk *c, const int32_t x, const int32_t y);
 
-int field_get_mines(struct chunk *c, const uint32_t x, const uint32_t y);
+int field_get_mines(struct game *game, struct chunk *c, const uint32_t x, const uint32_t y);
 
-void uncover_field_inbounds(struct chunk *c, uint32_t x, uint32_t y);
+void uncover_field_inbounds(struct game *game, struct chunk *c, uint32_t x, uint32_t y);
 
-void field_toggle_flag(struct chunk *c, const uint32_t x, const uint32_t y);
+void field_toggle_flag(struct game *game, struct chunk *c, const uint32_t x, const uint32_t y);
 
 #endif
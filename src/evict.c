@@ -0,0 +1,316 @@
+#include "evict.h"
+
+#include "arena.h"
+#include "chunk.h"
+#include "game.h"
+#include "lod.h"
+#include "save.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void insert_cold_slot(struct cold_slot *table, const uint32_t mask,
+							 const struct cold_slot *slot) {
+	uint32_t i;
+
+	i = chunk_hash(slot->x, slot->y) & mask;
+	while (table[i].runs != NULL) {
+		i = (i + 1) & mask;
+	}
+
+	table[i] = *slot;
+}
+
+void alloc_cold_table(struct game *game, const uint32_t size) {
+	struct cold_slot *new_cold;
+	uint32_t i;
+
+	new_cold = calloc(size, sizeof(*game->cold));
+
+	if (new_cold == NULL) {
+		handle_alloc_error();
+	}
+
+	if (game->cold != NULL) {
+		for (i = 0; i < game->cold_size; i++) {
+			if (game->cold[i].runs != NULL) {
+				insert_cold_slot(new_cold, size - 1, &game->cold[i]);
+			}
+		}
+		free(game->cold);
+	}
+
+	game->cold = new_cold;
+	game->cold_size = size;
+}
+
+static struct cold_slot *find_cold_slot(struct game *game, const uint32_t x, const uint32_t y) {
+	const uint32_t mask = game->cold_size - 1;
+	struct cold_slot *slot;
+	uint32_t i;
+
+	for (i = chunk_hash(x, y) & mask; (slot = &game->cold[i])->runs != NULL; i = (i + 1) & mask) {
+		if (slot->x == x && slot->y == y) {
+			return slot;
+		}
+	}
+
+	return NULL;
+}
+
+const struct cold_slot *find_cold_chunk(struct game *game, const uint32_t x, const uint32_t y) {
+	return find_cold_slot(game, x, y);
+}
+
+// backward shift deletion, like evict_chunk does for the chunk table
+static void remove_cold_slot(struct game *game, struct cold_slot *slot) {
+	const uint32_t mask = game->cold_size - 1;
+	uint32_t i, j, home;
+
+	i = slot - game->cold;
+
+	for (j = (i + 1) & mask; game->cold[j].runs != NULL; j = (j + 1) & mask) {
+		home = chunk_hash(game->cold[j].x, game->cold[j].y) & mask;
+		if (i <= j ? home <= i || home > j : home <= i && home > j) {
+			game->cold[i] = game->cold[j];
+			i = j;
+		}
+	}
+
+	game->cold[i].runs = NULL;
+	game->cold_count--;
+}
+
+static uint8_t field_run_state(const uint8_t field) {
+	return (ISSET(FIELD_UNCOVERED, field) ? COLD_RUN_UNCOVERED : 0) |
+		   (ISSET(FIELD_FLAG, field) ? COLD_RUN_FLAG : 0);
+}
+
+// run length encodes the uncovered and flag bits of all fields of c, returns the number of runs
+static uint16_t encode_runs(const struct chunk *c, uint16_t runs[CHUNK_SIZE * CHUNK_SIZE]) {
+	uint32_t i, start;
+	uint16_t count;
+	uint8_t state;
+
+	// a chunk without fields is one covered run
+	if (c->fields == NULL) {
+		runs[0] = CHUNK_SIZE * CHUNK_SIZE - 1;
+		return 1;
+	}
+
+	count = 0;
+	start = 0;
+	state = field_run_state(c->fields[0]);
+
+	for (i = 1; i <= CHUNK_SIZE * CHUNK_SIZE; i++) {
+		if (i == CHUNK_SIZE * CHUNK_SIZE || field_run_state(c->fields[i]) != state) {
+			runs[count++] = state << COLD_RUN_LENGTH_BITS | (i - start - 1);
+			if (i < CHUNK_SIZE * CHUNK_SIZE) {
+				start = i;
+				state = field_run_state(c->fields[i]);
+			}
+		}
+	}
+
+	return count;
+}
+
+// Evicts c, chunks that the seed can create again are dropped, the others are stored as runs
+static void freeze_chunk(struct game *game, struct chunk *c) {
+	uint16_t runs[CHUNK_SIZE * CHUNK_SIZE];
+	struct cold_slot slot;
+	uint16_t count;
+
+	count = encode_runs(c, runs);
+
+	// a chunk in the save file is not pristine even without state, it would be loaded from there
+	if (count > 1 || runs[0] >> COLD_RUN_LENGTH_BITS != 0 || ISSET(CHUNK_HIT, c->flags) ||
+		find_saved_chunk(game, c->x, c->y) != NULL) {
+		slot.x = c->x;
+		slot.y = c->y;
+		slot.runs_count = count;
+		slot.flags = c->flags & CHUNK_HIT;
+		slot.runs = malloc(count * sizeof(uint16_t));
+
+		if (slot.runs == NULL) {
+			handle_alloc_error();
+		}
+
+		memcpy(slot.runs, runs, count * sizeof(uint16_t));
+
+		slot.frontier = NULL;
+		if (ISSET(CHUNK_HIT, c->flags)) {
+			slot.frontier = malloc(sizeof(c->frontier) + sizeof(c->uncounted));
+
+			if (slot.frontier == NULL) {
+				handle_alloc_error();
+			}
+
+			memcpy(slot.frontier, c->frontier, sizeof(c->frontier));
+			memcpy(slot.frontier + 9, c->uncounted, sizeof(c->uncounted));
+		}
+
+		// same load factor as the chunk table
+		if ((game->cold_count + 1) * 2 > game->cold_size) {
+			alloc_cold_table(game, game->cold_size * 2);
+		}
+
+		insert_cold_slot(game->cold, game->cold_size - 1, &slot);
+		game->cold_count++;
+	}
+
+	evict_chunk(game, c);
+}
+
+// sets the uncovered and flag bits of a new chunk if it was evicted before, returns whether it was
+bool restore_cold_chunk(struct game *game, struct chunk *c) {
+	struct cold_slot *slot;
+	uint32_t i, r, end;
+	uint8_t bits;
+
+	slot = find_cold_slot(game, c->x, c->y);
+
+	if (slot == NULL) {
+		return false;
+	}
+
+	i = 0;
+	for (r = 0; r < slot->runs_count; r++) {
+		bits = (slot->runs[r] >> COLD_RUN_LENGTH_BITS & COLD_RUN_UNCOVERED ? FIELD_UNCOVERED : 0) |
+			   (slot->runs[r] >> COLD_RUN_LENGTH_BITS & COLD_RUN_FLAG ? FIELD_FLAG : 0);
+		end = i + (slot->runs[r] & (BIT(COLD_RUN_LENGTH_BITS) - 1)) + 1;
+		if (bits == 0) {
+			i = end;
+			continue;
+		}
+
+		expand_chunk(game, c);
+		for (; i < end; i++) {
+			SET(bits, c->fields[i]);
+		}
+	}
+
+	SET(slot->flags, c->flags);
+
+	if (slot->frontier != NULL) {
+		memcpy(c->frontier, slot->frontier, sizeof(c->frontier));
+		memcpy(c->uncounted, slot->frontier + 9, sizeof(c->uncounted));
+		free(slot->frontier);
+	}
+
+	free(slot->runs);
+	remove_cold_slot(game, slot);
+
+	return true;
+}
+
+// decodes an evicted chunk to bitboards, for the save file
+void cold_chunk_planes(const struct cold_slot *slot, uint64_t uncovered[CHUNK_SIZE],
+					   uint64_t flags[CHUNK_SIZE]) {
+	uint32_t i, r, end;
+	uint16_t state;
+
+	memset(uncovered, 0, CHUNK_SIZE * sizeof(uint64_t));
+	memset(flags, 0, CHUNK_SIZE * sizeof(uint64_t));
+
+	i = 0;
+	for (r = 0; r < slot->runs_count; r++) {
+		state = slot->runs[r] >> COLD_RUN_LENGTH_BITS;
+		end = i + (slot->runs[r] & (BIT(COLD_RUN_LENGTH_BITS) - 1)) + 1;
+		for (; i < end; i++) {
+			if (ISSET(COLD_RUN_UNCOVERED, state)) {
+				uncovered[i / CHUNK_SIZE] |= (uint64_t)1 << i % CHUNK_SIZE;
+			}
+			if (ISSET(COLD_RUN_FLAG, state)) {
+				flags[i / CHUNK_SIZE] |= (uint64_t)1 << i % CHUNK_SIZE;
+			}
+		}
+	}
+}
+
+// bytes used by the chunks, with their mines and fields
+size_t chunk_memory(struct game *game) {
+	return (size_t)game->chunk_arena.object_count * game->chunk_arena.object_size +
+		   (size_t)game->mines_arena.object_count * game->mines_arena.object_size +
+		   (size_t)game->fields_arena.object_count * game->fields_arena.object_size;
+}
+
+// chunk that may be evicted, ticks since it was used
+struct eviction_candidate {
+	struct chunk *c;
+	uint32_t age;
+};
+
+// least recently used first
+static int compare_age(const void *a, const void *b) {
+	const uint32_t age_a = ((const struct eviction_candidate *)a)->age,
+				   age_b = ((const struct eviction_candidate *)b)->age;
+
+	return (age_a < age_b) - (age_a > age_b);
+}
+
+// Advances game->tick, call this once per frame. Returns whether the chunks use more than
+// game->memory_budget, then evict_old_chunks has work.
+bool next_tick(struct game *game) {
+	game->tick++;
+
+	return !game->filling && chunk_memory(game) > game->memory_budget;
+}
+
+// Evicts the least recently used chunks until they use 3/4 of game->memory_budget, so this does
+// not run every frame. Chunks used in the last EVICT_MIN_AGE ticks stay, that are the chunks in and
+// next to the window. Chunk pointers that were kept since the last tick may be invalid afterwards.
+void evict_old_chunks(struct game *game) {
+	struct eviction_candidate *candidates;
+	uint32_t i, count;
+
+	if (game->filling || chunk_memory(game) <= game->memory_budget) {
+		return;
+	}
+
+	// the queue of changed summaries points to chunks
+	update_lod(game);
+
+	candidates = malloc(game->chunks_count * sizeof(struct eviction_candidate));
+
+	if (candidates == NULL) {
+		handle_alloc_error();
+	}
+
+	count = 0;
+	for (i = 0; i < game->chunks_size; i++) {
+		if (game->chunks[i].c != NULL && game->tick - game->chunks[i].c->used > EVICT_MIN_AGE) {
+			candidates[count].c = game->chunks[i].c;
+			candidates[count++].age = game->tick - game->chunks[i].c->used;
+		}
+	}
+
+	qsort(candidates, count, sizeof(struct eviction_candidate), compare_age);
+
+	for (i = 0; i < count && chunk_memory(game) > game->memory_budget / 4 * 3; i++) {
+		freeze_chunk(game, candidates[i].c);
+	}
+
+	free(candidates);
+}
+
+// next_tick and evict_old_chunks for callers that do not defer the eviction
+void evict_chunks(struct game *game) {
+	if (next_tick(game)) {
+		evict_old_chunks(game);
+	}
+}
+
+void free_cold_chunks(struct game *game) {
+	uint32_t i;
+
+	for (i = 0; i < game->cold_size; i++) {
+		if (game->cold[i].runs != NULL) {
+			free(game->cold[i].runs);
+			free(game->cold[i].frontier);
+		}
+	}
+
+	free(game->cold);
+}
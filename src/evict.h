@@ -0,0 +1,58 @@
+#ifndef EVICT_H
+#define EVICT_H
+
+#include "chunk.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// chunks are evicted when they use more memory than this (see chunk_memory), browsers limit memory
+// more
+#ifdef __EMSCRIPTEN__
+#define DEFAULT_MEMORY_BUDGET (64 * 1024 * 1024)
+#else
+#define DEFAULT_MEMORY_BUDGET (256 * 1024 * 1024)
+#endif
+// chunks used in the last EVICT_MIN_AGE ticks (frames) are never evicted
+#define EVICT_MIN_AGE 60
+#define COLD_TABLE_SIZE 256
+
+// run of fields with the same uncovered and flag state: the state (COLD_RUN_*) in the top bits and
+// the length - 1 in the low COLD_RUN_LENGTH_BITS bits
+#define COLD_RUN_LENGTH_BITS 12
+#define COLD_RUN_UNCOVERED 0x1
+#define COLD_RUN_FLAG 0x2
+
+_Static_assert(CHUNK_SIZE * CHUNK_SIZE <= 1 << COLD_RUN_LENGTH_BITS, "run length does not fit");
+
+// evicted chunk that has state the seed alone can not restore, runs is NULL for empty slots
+struct cold_slot {
+	uint32_t x, y;
+	uint16_t *runs;
+	// frontier and uncounted of the chunk if it has to be resumed (CHUNK_HIT), otherwise NULL
+	uint64_t *frontier;
+	uint16_t runs_count;
+	uint8_t flags;
+};
+
+void alloc_cold_table(struct game *game, const uint32_t size);
+
+size_t chunk_memory(struct game *game);
+
+bool next_tick(struct game *game);
+
+void evict_old_chunks(struct game *game);
+
+void evict_chunks(struct game *game);
+
+const struct cold_slot *find_cold_chunk(struct game *game, const uint32_t x, const uint32_t y);
+
+bool restore_cold_chunk(struct game *game, struct chunk *c);
+
+void cold_chunk_planes(const struct cold_slot *slot, uint64_t uncovered[CHUNK_SIZE],
+					   uint64_t flags[CHUNK_SIZE]);
+
+void free_cold_chunks(struct game *game);
+
+#endif
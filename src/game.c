@@ -1,42 +1,68 @@
 #include "game.h"
 
+#include "arena.h"
 #include "chunk.h"
+#include "evict.h"
+#include "lod.h"
+#include "pool.h"
+#include "prefetch.h"
 #include "renderer.h"
+#include "save.h"
+#include "trace.h"
 #include "util.h"
 
 #include <stdint.h>
 #include <stdlib.h>
 
-struct game *game;
+// frees game and everything in it, not the threads
+void free_game(struct game *game) {
+	close_save(game);
+	free_cold_chunks(game);
+	free_lod(game);
 
-void cleanup() {
-	uint32_t i;
+	free(game->chunks);
+	arena_free(&game->chunk_arena);
+	arena_free(&game->mines_arena);
+	arena_free(&game->fields_arena);
 
-	cleanup_renderer();
-
-	if (game->chunks) {
-		for (i = 0; i < game->chunks_count; i++) {
-			free(game->chunks[i]);
-		}
-		free(game->chunks);
-	}
+	free(game->fill_queue);
+	free(game->fill_checks);
+	free(game->fill_tasks);
 
 	free(game);
 }
 
-int init_game(const uint32_t seed) {
+void cleanup(struct game *game) {
+	// the workers use the game
+	stop_prefetch();
+	stop_pool();
+	// no thread records events anymore
+	flush_trace();
+	free_game(game);
+}
+
+struct game *init_game(const uint32_t seed) {
+	struct game *game;
+
 	game = calloc(1, sizeof(struct game));
 
 	if (game == NULL) {
 		handle_alloc_error();
 	}
 
-	alloc_chunk_list(CHUNK_LIST_SIZE);
+	alloc_chunk_table(game, CHUNK_TABLE_SIZE);
+	arena_init(&game->chunk_arena, sizeof(struct chunk_block));
+	arena_init(&game->mines_arena, sizeof(uint64_t) * CHUNK_SIZE);
+	arena_init(&game->fields_arena, CHUNK_SIZE * CHUNK_SIZE);
+	alloc_cold_table(game, COLD_TABLE_SIZE);
+	alloc_lod_table(game, LOD_TABLE_SIZE);
 
 	game->seed = seed;
 	game->mine_threshold = DEFAULT_MINE_THRESHOLD;
+	game->memory_budget = DEFAULT_MEMORY_BUDGET;
+	game->fill_threads = 1;
 	game->dirty = 1;
 	game->square_size = SQUARE_SIZE_DEFAULT;
 
-	return 0;
+	return game;
 }
@@ -1,26 +1,91 @@
 #ifndef GAME_H
 #define GAME_H
 
+#include "arena.h"
 #include "chunk.h"
+#include "evict.h"
+#include "lod.h"
+#include "save.h"
+#include "stats.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define MINE_PERCENTAGE 10
 #define DEFAULT_MINE_THRESHOLD (-1U / 100 * (100 - MINE_PERCENTAGE))
+#define DIRTY_RECTS 64
+
+// Returns whether chunk c is visible to the player of the game, data is the visibility_data of the
+// game. The renderer shows the chunks inside the window, the server the chunks its clients look at.
+typedef bool (*visibility_hook)(const struct chunk *c, void *data);
+
+// fields min_x..max_x, min_y..max_y of the chunk at x, y changed since the last frame
+struct dirty_rect {
+	uint32_t x, y;
+	uint8_t min_x, min_y, max_x, max_y;
+};
 
 struct game {
-	struct chunk **chunks;
+	// open addressing hash table of all chunks, chunks_size slots of which chunks_count are used
+	struct chunk_slot *chunks;
+	// memory of all chunks, in blocks (see struct chunk_block), and of the mines and fields of the
+	// chunks that have them
+	struct arena chunk_arena, mines_arena, fields_arena;
 	uint32_t chunks_count, chunks_size, mine_threshold, seed;
+	// evicted chunks (see evict.c), open addressing like chunks
+	struct cold_slot *cold;
+	uint32_t cold_count, cold_size;
+	// bytes the chunks may use before they are evicted, and the frame counter for their age
+	size_t memory_budget;
+	uint32_t tick;
+	// flood fill work queue and the chunks that became visible during the fill (see
+	// check_covered_fields)
+	struct fill_cell *fill_queue;
+	struct chunk **fill_checks;
+	uint32_t fill_count, fill_size, fill_checks_count, fill_checks_size;
+	bool filling;
+	// threads of the flood fill, with more than one the fill runs in rounds of one task per chunk
+	// (see run_parallel_fill)
+	struct fill_task *fill_tasks;
+	uint32_t fill_threads, fill_tasks_size;
+	// flood fills only spread into and continue in visible chunks (see is_visible), without a hook
+	// no chunk is visible
+	visibility_hook visibility;
+	void *visibility_data;
 	int64_t view_x, view_y;
-	int square_size;
+	// fields are square_size pixels when zoom_out is 0, otherwise a chunk is
+	// CHUNK_SIZE * SQUARE_SIZE_MIN >> zoom_out pixels and drawn from its summary
+	int square_size, zoom_out;
+	// summaries of all chunks that ever changed and of squares of them (see lod.c), open addressing
+	// like chunks, and the chunks whose summaries changed since the last update_lod
+	struct lod_node *lod;
+	uint32_t lod_count, lod_size;
+	struct chunk **lod_queue;
+	uint32_t lod_queue_count, lod_queue_size;
+	// memory mapped save file that chunks are loaded from when they are first needed, NULL for a
+	// new game (see save.c)
+	const struct save_header *save;
+	size_t save_size;
+	// fields the renderer has to draw again, one rectangle per chunk (see mark_field_dirty), dirty
+	// is set when the whole window has to be drawn again
+	struct dirty_rect dirty_rects[DIRTY_RECTS];
+	uint32_t dirty_rects_count;
 	bool dirty, dead;
+#ifndef NO_STATS
+	// see stats.h
+	uint64_t stats[STAT_COUNT];
+#endif
 };
 
-extern struct game *game;
+// The game core keeps no state of its own, every function gets the game it works on. Games do not
+// share anything, so threads can play different games at the same time. The fill pool and the
+// prefetch worker serve one game at a time, the other games fill on their own thread meanwhile.
+
+void free_game(struct game *game);
 
-void cleanup();
+void cleanup(struct game *game);
 
-int init_game(const uint32_t seed);
+struct game *init_game(const uint32_t seed);
 
 #endif
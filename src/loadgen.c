@@ -0,0 +1,473 @@
+#ifdef LOADGEN
+
+#include "chunk.h"
+#include "protocol.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Load generator for the game server (see server.c). Every client keeps one request in flight and
+// sends the next one as soon as the reply arrives. Players start their own game, look at a region
+// of it and uncover and flag random fields there, a lost game is left for a new one. Spectators
+// join the game of a player, subscribe to its region and ask for a part of it again and again, the
+// changes the player makes are pushed to them in between. Prints the latency of the requests and
+// the actions (uncovers and flags) per second in the key=value format of the benchmarks.
+
+#define LOADGEN_CLIENTS 4096
+#define LOADGEN_SECONDS 5
+#define LOADGEN_THREADS 4
+#define LOADGEN_EVENTS 256
+// one in this many clients is a spectator
+#define LOADGEN_SPECTATOR_EVERY 8
+// a spectator watches another game after this many requests
+#define LOADGEN_SPECTATOR_REQUESTS 64
+// size of the region of a spectator's requests
+#define LOADGEN_SPECTATOR_REGION 16
+// the server may still be starting
+#define LOADGEN_CONNECT_TRIES 100
+// largest reply, MSG_FIELDS of a full region
+#define REPLY_SIZE_MAX                                                                             \
+	(1 + sizeof(struct proto_rect) + FIELDS_SIZE(REGION_SIZE_MAX, REGION_SIZE_MAX))
+
+struct client {
+	int fd;
+	bool spectator;
+	// session of the game, 0 before MSG_JOINED
+	uint32_t session;
+	// region a player plays in and a spectator watches
+	struct proto_rect region;
+	uint32_t requests, rng;
+	// when the request in flight was sent, 0 when there is none
+	uint64_t sent_ns;
+	uint8_t in[REPLY_SIZE_MAX * 2];
+	uint32_t in_count;
+};
+
+struct worker {
+	pthread_t thread;
+	int epoll;
+	struct client *clients;
+	uint32_t clients_count;
+	// latency of every request in ns
+	uint32_t *latencies;
+	uint64_t latencies_count, latencies_size;
+	uint64_t actions, pushes, games, errors;
+};
+
+static struct sockaddr_un address = {.sun_family = AF_UNIX};
+static uint64_t deadline_ns;
+
+static uint64_t now_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t next_random(struct client *c) {
+	c->rng ^= c->rng << 13;
+	c->rng ^= c->rng >> 17;
+	c->rng ^= c->rng << 5;
+
+	return c->rng;
+}
+
+static void send_request(struct client *c, const uint8_t type, const void *body,
+						 const uint32_t size) {
+	uint8_t message[1 + sizeof(struct proto_rect)];
+
+	message[0] = type;
+	memcpy(message + 1, body, size);
+
+	// one small request is in flight at a time, the socket always has room for it
+	if (send(c->fd, message, 1 + size, MSG_NOSIGNAL) != 1 + size) {
+		perror("Could not send a request");
+		exit(1);
+	}
+
+	c->sent_ns = now_ns();
+}
+
+// Connects c and joins the game of a player of w, or a new game if c is a player, returns false if
+// there is no game to watch yet
+static bool connect_client(struct worker *w, struct client *c) {
+	struct epoll_event event;
+	struct proto_join join;
+	struct client *player;
+	uint32_t tries;
+
+	join.session = 0;
+	join.seed = next_random(c);
+
+	if (c->spectator) {
+		player = &w->clients[next_random(c) % w->clients_count];
+		if (player->spectator || player->session == 0) {
+			return false;
+		}
+		join.session = player->session;
+		c->region = player->region;
+	}
+
+	c->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	for (tries = 0; connect(c->fd, (struct sockaddr *)&address, sizeof(address)) != 0; tries++) {
+		if ((errno != ENOENT && errno != ECONNREFUSED) || tries >= LOADGEN_CONNECT_TRIES) {
+			perror("Could not connect");
+			exit(1);
+		}
+		usleep(20000);
+	}
+
+	event.events = EPOLLIN;
+	event.data.ptr = c;
+	epoll_ctl(w->epoll, EPOLL_CTL_ADD, c->fd, &event);
+
+	c->session = 0;
+	c->requests = 0;
+	c->in_count = 0;
+	send_request(c, MSG_JOIN, &join, sizeof(join));
+
+	return true;
+}
+
+static void disconnect_client(struct worker *w, struct client *c) {
+	epoll_ctl(w->epoll, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+	c->session = 0;
+	c->sent_ns = 0;
+}
+
+// Sends the next request of c after the reply to the last one
+static void next_request(struct client *c) {
+	struct proto_rect region;
+	struct proto_pos pos;
+	uint32_t r;
+
+	if (c->spectator) {
+		region = c->region;
+		region.pos.fx = next_random(c) % (REGION_SIZE_MAX - LOADGEN_SPECTATOR_REGION);
+		region.pos.fy = next_random(c) % (REGION_SIZE_MAX - LOADGEN_SPECTATOR_REGION);
+		region.w = region.h = LOADGEN_SPECTATOR_REGION;
+		send_request(c, MSG_REGION, &region, sizeof(region));
+		return;
+	}
+
+	r = next_random(c) % 100;
+	pos = c->region.pos;
+	pos.fx = next_random(c) % CHUNK_SIZE;
+	pos.fy = next_random(c) % CHUNK_SIZE;
+
+	if (r < 75) {
+		send_request(c, MSG_UNCOVER, &pos, sizeof(pos));
+	} else if (r < 95) {
+		send_request(c, MSG_FLAG, &pos, sizeof(pos));
+	} else {
+		send_request(c, MSG_REGION, &c->region, sizeof(c->region));
+	}
+}
+
+// Returns the size of the reply at the start of in, 0 if it is not complete yet
+static uint32_t reply_size(const uint8_t *in, const uint32_t count) {
+	struct proto_rect rect;
+
+	switch (in[0]) {
+	case MSG_JOINED:
+		return 1 + sizeof(struct proto_join);
+	case MSG_RESULT:
+		return 1 + sizeof(struct proto_result);
+	case MSG_ERROR:
+		return 1 + sizeof(struct proto_error);
+	case MSG_FIELDS:
+	case MSG_CHANGED:
+		if (count < 1 + sizeof(rect)) {
+			return 0;
+		}
+		memcpy(&rect, in + 1, sizeof(rect));
+		return 1 + sizeof(rect) + FIELDS_SIZE(rect.w, rect.h);
+	default:
+		printf("Unknown reply %u\n", in[0]);
+		exit(1);
+	}
+}
+
+static void record_latency(struct worker *w, struct client *c) {
+	uint64_t latency;
+	uint32_t *new_latencies;
+
+	if (w->latencies_count >= w->latencies_size) {
+		w->latencies_size = w->latencies_size ? w->latencies_size * 2 : 1 << 16;
+		new_latencies = realloc(w->latencies, sizeof(*w->latencies) * w->latencies_size);
+
+		if (new_latencies == NULL) {
+			printf("Out of memory\n");
+			exit(1);
+		}
+
+		w->latencies = new_latencies;
+	}
+
+	latency = now_ns() - c->sent_ns;
+	w->latencies[w->latencies_count++] = latency > UINT32_MAX ? UINT32_MAX : latency;
+	c->sent_ns = 0;
+	c->requests++;
+}
+
+// Handles one reply of c, returns false if c was disconnected
+static bool handle_reply(struct worker *w, struct client *c, const uint8_t *reply) {
+	struct proto_result result;
+	struct proto_join joined;
+
+	if (reply[0] == MSG_CHANGED) {
+		w->pushes++;
+		return true;
+	}
+
+	record_latency(w, c);
+
+	switch (reply[0]) {
+	case MSG_JOINED:
+		memcpy(&joined, reply + 1, sizeof(joined));
+		c->session = joined.session;
+
+		if (c->spectator) {
+			send_request(c, MSG_SUBSCRIBE, &c->region, sizeof(c->region));
+		} else {
+			w->games++;
+			c->region.pos.cx = next_random(c) % 1024;
+			c->region.pos.cy = next_random(c) % 1024;
+			c->region.pos.fx = c->region.pos.fy = 0;
+			c->region.w = c->region.h = REGION_SIZE_MAX;
+			send_request(c, MSG_REGION, &c->region, sizeof(c->region));
+		}
+		return true;
+	case MSG_RESULT:
+		memcpy(&result, reply + 1, sizeof(result));
+		w->actions++;
+
+		if (result.dead) {
+			disconnect_client(w, c);
+			return false;
+		}
+		break;
+	case MSG_ERROR:
+		// the game of a spectator can end before it joins
+		w->errors++;
+		disconnect_client(w, c);
+		return false;
+	}
+
+	if (c->spectator && c->requests >= LOADGEN_SPECTATOR_REQUESTS) {
+		disconnect_client(w, c);
+		return false;
+	}
+
+	next_request(c);
+
+	return true;
+}
+
+static void read_replies(struct worker *w, struct client *c) {
+	uint32_t used, size;
+	ssize_t n;
+
+	n = recv(c->fd, c->in + c->in_count, sizeof(c->in) - c->in_count, MSG_DONTWAIT);
+
+	if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return;
+	}
+	if (n <= 0) {
+		printf("The server closed a connection\n");
+		exit(1);
+	}
+
+	c->in_count += n;
+
+	used = 0;
+	while (used < c->in_count) {
+		size = reply_size(c->in + used, c->in_count - used);
+
+		if (size == 0 || c->in_count - used < size) {
+			break;
+		}
+
+		if (!handle_reply(w, c, c->in + used)) {
+			return;
+		}
+
+		used += size;
+	}
+
+	c->in_count -= used;
+	memmove(c->in, c->in + used, c->in_count);
+}
+
+static void *run_worker(void *arg) {
+	struct epoll_event events[LOADGEN_EVENTS];
+	struct worker *w;
+	struct client *c;
+	uint64_t now;
+	uint32_t i;
+	int n;
+
+	w = arg;
+
+	while ((now = now_ns()) < deadline_ns) {
+		// clients that left their game join the next one
+		for (i = 0; i < w->clients_count; i++) {
+			if (w->clients[i].fd < 0) {
+				connect_client(w, &w->clients[i]);
+			}
+		}
+
+		n = epoll_wait(w->epoll, events, LOADGEN_EVENTS, (deadline_ns - now) / 1000000 + 1);
+
+		for (i = 0; i < (uint32_t)n; i++) {
+			c = events[i].data.ptr;
+			read_replies(w, c);
+		}
+	}
+
+	for (i = 0; i < w->clients_count; i++) {
+		if (w->clients[i].fd >= 0) {
+			close(w->clients[i].fd);
+		}
+	}
+
+	return NULL;
+}
+
+static int compare_latencies(const void *a, const void *b) {
+	const uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+	struct worker workers[LOADGEN_THREADS];
+	uint64_t start, elapsed, requests, actions, pushes, games, errors, offset;
+	uint32_t clients, seconds, i, j, spectators;
+	const char *path;
+	struct rlimit limit;
+	uint32_t *latencies;
+
+	path = SERVER_SOCKET;
+	clients = LOADGEN_CLIENTS;
+	seconds = LOADGEN_SECONDS;
+
+	if (argc > 4 || (argc > 2 && (sscanf(argv[2], "%u", &clients) != 1 || clients == 0)) ||
+		(argc > 3 && (sscanf(argv[3], "%u", &seconds) != 1 || seconds == 0))) {
+		printf("Usage: %s [socket] [clients] [seconds]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 1) {
+		path = argv[1];
+	}
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		printf("Socket path %s is too long\n", path);
+		return 1;
+	}
+	strcpy(address.sun_path, path);
+
+	// every client is a file descriptor
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	spectators = 0;
+	start = now_ns();
+	deadline_ns = start + (uint64_t)seconds * 1000000000;
+
+	for (i = 0; i < LOADGEN_THREADS; i++) {
+		memset(&workers[i], 0, sizeof(workers[i]));
+		workers[i].epoll = epoll_create1(EPOLL_CLOEXEC);
+		workers[i].clients_count = clients / LOADGEN_THREADS + (i < clients % LOADGEN_THREADS);
+		workers[i].clients = calloc(workers[i].clients_count + 1, sizeof(struct client));
+
+		if (workers[i].epoll < 0 || workers[i].clients == NULL) {
+			printf("Could not start the clients\n");
+			return 1;
+		}
+
+		// the players connect first, the spectators join their games once they started
+		for (j = 0; j < workers[i].clients_count; j++) {
+			workers[i].clients[j].fd = -1;
+			workers[i].clients[j].rng = (i * clients + j) * 2654435761u | 1;
+			workers[i].clients[j].spectator = j % LOADGEN_SPECTATOR_EVERY == 1;
+			spectators += workers[i].clients[j].spectator;
+
+			if (!workers[i].clients[j].spectator) {
+				connect_client(&workers[i], &workers[i].clients[j]);
+			}
+		}
+	}
+
+	for (i = 0; i < LOADGEN_THREADS; i++) {
+		if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0) {
+			printf("Could not start the clients\n");
+			return 1;
+		}
+	}
+
+	requests = actions = pushes = games = errors = 0;
+	for (i = 0; i < LOADGEN_THREADS; i++) {
+		pthread_join(workers[i].thread, NULL);
+		requests += workers[i].latencies_count;
+		actions += workers[i].actions;
+		pushes += workers[i].pushes;
+		games += workers[i].games;
+		errors += workers[i].errors;
+	}
+	elapsed = now_ns() - start;
+
+	latencies = malloc(sizeof(*latencies) * (requests + 1));
+
+	if (latencies == NULL) {
+		printf("Out of memory\n");
+		return 1;
+	}
+
+	offset = 0;
+	for (i = 0; i < LOADGEN_THREADS; i++) {
+		memcpy(latencies + offset, workers[i].latencies,
+			   sizeof(*latencies) * workers[i].latencies_count);
+		offset += workers[i].latencies_count;
+		free(workers[i].latencies);
+		free(workers[i].clients);
+		close(workers[i].epoll);
+	}
+
+	qsort(latencies, requests, sizeof(*latencies), compare_latencies);
+
+	printf("loadgen clients=%u spectators=%u seconds=%.2f requests=%llu actions=%llu games=%llu "
+		   "pushes=%llu errors=%llu\n",
+		   clients, spectators, elapsed / 1e9, (unsigned long long)requests,
+		   (unsigned long long)actions, (unsigned long long)games, (unsigned long long)pushes,
+		   (unsigned long long)errors);
+	if (requests > 0) {
+		printf("latency p50_us=%.1f p99_us=%.1f p999_us=%.1f max_us=%.1f actions_per_sec=%.0f "
+			   "requests_per_sec=%.0f\n",
+			   latencies[requests / 2] / 1e3, latencies[requests * 99 / 100] / 1e3,
+			   latencies[requests * 999 / 1000] / 1e3, latencies[requests - 1] / 1e3,
+			   actions / (elapsed / 1e9), requests / (elapsed / 1e9));
+	}
+
+	free(latencies);
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,164 @@
+#include "lod.h"
+
+#include "chunk.h"
+#include "game.h"
+#include "util.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// The level of detail pyramid sums up the uncovered and flagged fields of squares of chunks, level
+// 0 is one chunk, every level above combines 2x2 nodes of the level below. The renderer draws
+// zoomed out views and the minimap from it, the cost only depends on the number of nodes in the
+// window. Chunks count their fields on every change and queue themselves (see mark_field_dirty),
+// the changes are added to all levels once per frame by update_lod. Nodes stay when their chunks
+// are evicted, so explored parts of the game can be seen without loading them.
+
+static uint32_t lod_hash(const uint32_t level, const uint32_t x, const uint32_t y) {
+	return chunk_hash(x, y) ^ level * 0x9e3779b9;
+}
+
+static void insert_lod_node(struct lod_node *table, const uint32_t mask, const struct lod_node *n) {
+	uint32_t i;
+
+	i = lod_hash(n->level, n->x, n->y) & mask;
+	while (table[i].used) {
+		i = (i + 1) & mask;
+	}
+
+	table[i] = *n;
+}
+
+void alloc_lod_table(struct game *game, const uint32_t size) {
+	struct lod_node *new_lod;
+	uint32_t i;
+
+	new_lod = calloc(size, sizeof(*game->lod));
+
+	if (new_lod == NULL) {
+		handle_alloc_error();
+	}
+
+	if (game->lod != NULL) {
+		for (i = 0; i < game->lod_size; i++) {
+			if (game->lod[i].used) {
+				insert_lod_node(new_lod, size - 1, &game->lod[i]);
+			}
+		}
+		free(game->lod);
+	}
+
+	game->lod = new_lod;
+	game->lod_size = size;
+}
+
+static struct lod_node *get_lod_node(struct game *game, const uint32_t level, const uint32_t x,
+									 const uint32_t y) {
+	uint32_t mask, i;
+	struct lod_node *n;
+
+	mask = game->lod_size - 1;
+	for (i = lod_hash(level, x, y) & mask; (n = &game->lod[i])->used; i = (i + 1) & mask) {
+		if (n->level == level && n->x == x && n->y == y) {
+			return n;
+		}
+	}
+
+	if ((game->lod_count + 1) * 2 > game->lod_size) {
+		alloc_lod_table(game, game->lod_size * 2);
+
+		mask = game->lod_size - 1;
+		for (i = lod_hash(level, x, y) & mask; game->lod[i].used; i = (i + 1) & mask) {
+		}
+		n = &game->lod[i];
+	}
+
+	n->x = x;
+	n->y = y;
+	n->uncovered = n->flags = 0;
+	n->level = level;
+	n->used = true;
+	game->lod_count++;
+
+	return n;
+}
+
+// returns the node of level at x, y (the chunk position >> level), NULL if nothing there changed
+const struct lod_node *find_lod_node(struct game *game, const uint32_t level, const uint32_t x,
+									 const uint32_t y) {
+	const uint32_t mask = game->lod_size - 1;
+	struct lod_node *n;
+	uint32_t i;
+
+	for (i = lod_hash(level, x, y) & mask; (n = &game->lod[i])->used; i = (i + 1) & mask) {
+		if (n->level == level && n->x == x && n->y == y) {
+			return n;
+		}
+	}
+
+	return NULL;
+}
+
+// queues c for the next update_lod
+void queue_summary(struct game *game, struct chunk *c) {
+	struct chunk **new_queue;
+	uint32_t size;
+
+	if (ISSET(CHUNK_SUMMARY_CHANGED, c->flags)) {
+		return;
+	}
+
+	if (game->lod_queue_count >= game->lod_queue_size) {
+		size = game->lod_queue_size ? game->lod_queue_size * 2 : LOD_TABLE_SIZE;
+		new_queue = realloc(game->lod_queue, sizeof(*game->lod_queue) * size);
+
+		if (new_queue == NULL) {
+			handle_alloc_error();
+		}
+
+		game->lod_queue = new_queue;
+		game->lod_queue_size = size;
+	}
+
+	game->lod_queue[game->lod_queue_count++] = c;
+	SET(CHUNK_SUMMARY_CHANGED, c->flags);
+}
+
+// adds uncovered and flags fields of the chunk at x, y to every level
+void add_summary(struct game *game, const uint32_t x, const uint32_t y, const int32_t uncovered,
+				 const int32_t flags) {
+	struct lod_node *n;
+	uint32_t level;
+
+	if (uncovered == 0 && flags == 0) {
+		return;
+	}
+
+	for (level = 0; level < LOD_LEVELS; level++) {
+		n = get_lod_node(game, level, x >> level, y >> level);
+		n->uncovered += uncovered;
+		n->flags += flags;
+	}
+}
+
+// Adds the changes of the queued chunks to the pyramid, before the renderer uses it and before
+// chunks are evicted
+void update_lod(struct game *game) {
+	struct lod_node *n;
+	struct chunk *c;
+
+	while (game->lod_queue_count > 0) {
+		c = game->lod_queue[--game->lod_queue_count];
+		UNSET(CHUNK_SUMMARY_CHANGED, c->flags);
+
+		n = get_lod_node(game, 0, c->x, c->y);
+		add_summary(game, c->x, c->y, c->uncovered_count - (int32_t)n->uncovered,
+					c->flags_count - (int32_t)n->flags);
+	}
+}
+
+void free_lod(struct game *game) {
+	free(game->lod);
+	free(game->lod_queue);
+}
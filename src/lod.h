@@ -0,0 +1,37 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include "chunk.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// level l of the pyramid sums up squares of 2^l * 2^l chunks
+#define LOD_LEVELS 8
+#define LOD_TABLE_SIZE 256
+// zoomed out a chunk is CHUNK_SIZE * SQUARE_SIZE_MIN >> zoom_out pixels, 1 pixel at most
+#define LOD_ZOOM_OUT_MAX 10
+
+// Summary of the square of chunks at x, y of level, x and y are the chunk position >> level. used
+// is false for empty slots.
+struct lod_node {
+	uint32_t x, y, uncovered, flags;
+	uint8_t level;
+	bool used;
+};
+
+void alloc_lod_table(struct game *game, const uint32_t size);
+
+void queue_summary(struct game *game, struct chunk *c);
+
+void add_summary(struct game *game, const uint32_t x, const uint32_t y, const int32_t uncovered,
+				 const int32_t flags);
+
+void update_lod(struct game *game);
+
+const struct lod_node *find_lod_node(struct game *game, const uint32_t level, const uint32_t x,
+									 const uint32_t y);
+
+void free_lod(struct game *game);
+
+#endif
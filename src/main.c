@@ -2,55 +2,115 @@
 
 #include "chunk.h"
 #include "game.h"
+#include "pool.h"
 #include "renderer.h"
+#include "replay.h"
+#include "save.h"
+#include "trace.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-int main(int argc, char **argv) {
+static int parse_seed(const char *arg, uint32_t *seed) {
 	int i, err;
-	uint32_t seed;
 	uint64_t temp;
 
-	if (argc > 1) {
-		err = 1;
-		// UINT32_MAX string length = 10
-		for (i = 0; i < 10; i++) {
-			if (argv[1][i] < '0' || argv[1][i] > '9') {
-				printf("Invalid argument, please input a positive number\n");
-				return 1;
-			}
-			if (argv[1][i + 1] == '\0') {
-				err = 0;
-				break;
-			}
+	err = 1;
+	// UINT32_MAX string length = 10
+	for (i = 0; i < 10; i++) {
+		if (arg[i] < '0' || arg[i] > '9') {
+			printf("Invalid argument, please input a positive number\n");
+			return 1;
+		}
+		if (arg[i + 1] == '\0') {
+			err = 0;
+			break;
+		}
+	}
+	if (err) {
+		printf("Number too large\n");
+		return 1;
+	}
+	temp = strtoul(arg, NULL, 10);
+	if (temp > UINT32_MAX) {
+		printf("Number too large\n");
+		return 1;
+	}
+	*seed = temp;
+
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	const char *seed_arg = NULL, *record = NULL, *replay = NULL;
+	bool timed = false, headless = false;
+	struct game *game = NULL;
+	uint32_t seed;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			record = argv[++i];
+		} else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+			replay = argv[++i];
+		} else if (strcmp(argv[i], "--timed") == 0) {
+			timed = true;
+		} else if (strcmp(argv[i], "--headless") == 0) {
+			headless = true;
+		} else if (seed_arg == NULL && argv[i][0] != '-') {
+			seed_arg = argv[i];
+		} else {
+			printf("Usage: %s [seed] [--record file | --replay file [--timed] [--headless]]\n",
+				   argv[0]);
+			return 1;
 		}
-		if (err) {
-			printf("Number too large\n");
+	}
+
+	if ((replay != NULL && (record != NULL || seed_arg != NULL)) ||
+		(replay == NULL && (timed || headless))) {
+		printf("A replay has its own seed and can not be recorded, --timed and --headless only "
+			   "apply to --replay\n");
+		return 1;
+	}
+
+	if (replay != NULL) {
+		if (load_replay(replay, timed, headless, &seed)) {
 			return 1;
 		}
-		temp = strtoul(argv[1], NULL, 10);
-		if (temp > UINT32_MAX) {
-			printf("Number too large\n");
+		printf("Replaying %s (seed %u)\n", replay, seed);
+	} else if (seed_arg != NULL) {
+		if (parse_seed(seed_arg, &seed)) {
 			return 1;
 		}
-		seed = temp;
 		printf("Using seed %u\n", seed);
+	} else if (record == NULL && (game = load_game(SAVE_FILE)) != NULL) {
+		// a recording starts a new game, a replay can not load the saved one
+		printf("Continuing saved game from %s (seed %u)\n", SAVE_FILE, game->seed);
 	} else {
 		seed = time(NULL);
 		printf("No seed set, using %u (time)\n", seed);
 	}
 
-	if (init_game(seed)) {
-		return 1;
+	// a saved game is already started by load_game
+	if (game == NULL) {
+		game = init_game(seed);
 	}
 
-	start_renderer();
+	if (record != NULL) {
+		start_recording(record);
+		printf("Recording to %s\n", record);
+	}
 
-	return 0;
+	// big reveals are filled on all cores
+	game->fill_threads = cpu_count();
+
+	start_trace(TRACE_FILE);
+
+	return start_renderer(game);
 }
 
 #endif
@@ -0,0 +1,208 @@
+#include "pool.h"
+
+#include "arena.h"
+#include "trace.h"
+
+#include <stdint.h>
+
+#ifdef POOL_THREADS
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// Every thread of the pool has a queue of tasks, a range of task numbers. A thread runs the tasks
+// of its own queue first and then steals the tasks that are left in the queues of the others,
+// taking a task is one atomic increment of the start of a queue. run_pool returns when all tasks
+// ran.
+struct pool_queue {
+	_Alignas(CACHE_LINE_SIZE) _Atomic uint32_t next;
+	uint32_t end;
+};
+
+static struct pool_queue queues[POOL_THREADS_MAX];
+static pthread_t threads[POOL_THREADS_MAX];
+// thread 0 is the one that calls run_pool
+static uint32_t threads_count = 1;
+// threads the last start_pool call asked for, the pool has fewer when they could not be started
+static uint32_t threads_requested = 1;
+
+// posted once per thread for every run_pool call and to stop the threads
+static sem_t work;
+// posted by a thread when the queues are empty
+static sem_t done;
+static atomic_bool stopping;
+
+static void (*pool_run)(const uint32_t task);
+
+// held by the game that uses the pool, see try_lock_pool
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint32_t cpu_count() {
+	long count;
+
+	count = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (count < 1) {
+		return 1;
+	}
+	if (count > POOL_THREADS_MAX) {
+		return POOL_THREADS_MAX;
+	}
+
+	return count;
+}
+
+static void run_queues(const uint32_t self) {
+	struct pool_queue *q;
+	uint32_t i, task;
+
+	for (i = 0; i < threads_count; i++) {
+		q = &queues[(self + i) % threads_count];
+		while ((task = atomic_fetch_add_explicit(&q->next, 1, memory_order_relaxed)) < q->end) {
+			pool_run(task);
+		}
+	}
+}
+
+static void *run_thread(void *arg) {
+	const uint32_t self = (uintptr_t)arg;
+
+	trace_thread_name("pool");
+
+	for (;;) {
+		if (sem_wait(&work) != 0) {
+			continue;
+		}
+
+		if (atomic_load(&stopping)) {
+			return NULL;
+		}
+
+		run_queues(self);
+
+		sem_post(&done);
+	}
+}
+
+// Starts threads - 1 threads, the calling thread is the other one. When a thread can not be started
+// the pool has fewer threads.
+void start_pool(const uint32_t threads_wanted) {
+	uint32_t i;
+
+	// a pool that came out short is kept, starting it again would most likely fail again
+	if (threads_wanted == threads_requested) {
+		return;
+	}
+
+	stop_pool();
+	threads_requested = threads_wanted;
+
+	if (threads_wanted <= 1) {
+		return;
+	}
+
+	if (sem_init(&work, 0, 0) != 0 || sem_init(&done, 0, 0) != 0) {
+		printf("Could not start the thread pool, the flood fill runs on one thread\n");
+		return;
+	}
+
+	atomic_store(&stopping, false);
+
+	for (i = 1; i < threads_wanted && i < POOL_THREADS_MAX; i++) {
+		if (pthread_create(&threads[i], NULL, run_thread, (void *)(uintptr_t)i) != 0) {
+			printf("Could only start %u threads\n", i);
+			break;
+		}
+		threads_count++;
+	}
+}
+
+void stop_pool() {
+	uint32_t i;
+
+	threads_requested = 1;
+
+	if (threads_count == 1) {
+		return;
+	}
+
+	atomic_store(&stopping, true);
+	for (i = 1; i < threads_count; i++) {
+		sem_post(&work);
+	}
+	for (i = 1; i < threads_count; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	sem_destroy(&work);
+	sem_destroy(&done);
+
+	threads_count = 1;
+}
+
+// Runs run(0) to run(count - 1) on the threads of the pool
+void run_pool(void (*run)(const uint32_t task), const uint32_t count) {
+	uint32_t i;
+
+	pool_run = run;
+
+	for (i = 0; i < threads_count; i++) {
+		atomic_store_explicit(&queues[i].next, count * i / threads_count, memory_order_relaxed);
+		queues[i].end = count * (i + 1) / threads_count;
+	}
+
+	// a thread that finds all queues empty is done at once, so a thread may take the turn of
+	// another one, run_queues covers all queues anyway
+	for (i = 1; i < threads_count; i++) {
+		sem_post(&work);
+	}
+
+	run_queues(0);
+
+	for (i = 1; i < threads_count; i++) {
+		while (sem_wait(&done) != 0) {
+		}
+	}
+}
+
+// Returns whether the pool was free, the caller then has it until unlock_pool. Games on other
+// threads would run their tasks in the same queues, a game that finds the pool in use fills on its
+// own thread instead of waiting.
+bool try_lock_pool() {
+	return pthread_mutex_trylock(&pool_lock) == 0;
+}
+
+void unlock_pool() {
+	pthread_mutex_unlock(&pool_lock);
+}
+
+#else
+
+// without threads the tasks run one after another
+
+uint32_t cpu_count() {
+	return 1;
+}
+
+void start_pool(const uint32_t threads) {}
+
+void stop_pool() {}
+
+void run_pool(void (*run)(const uint32_t task), const uint32_t count) {
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		run(i);
+	}
+}
+
+bool try_lock_pool() {
+	return true;
+}
+
+void unlock_pool() {}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// the pool needs pthreads, the web build only has them when it is built with -pthread
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+#define POOL_THREADS
+#endif
+
+// most threads a pool can have, the calling thread included
+#define POOL_THREADS_MAX 16
+
+uint32_t cpu_count();
+
+void start_pool(const uint32_t threads);
+
+void stop_pool();
+
+void run_pool(void (*run)(const uint32_t task), const uint32_t count);
+
+bool try_lock_pool();
+
+void unlock_pool();
+
+#endif
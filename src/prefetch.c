@@ -0,0 +1,253 @@
+#include "prefetch.h"
+
+#include "chunk.h"
+#include "game.h"
+#include "trace.h"
+#include "util.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef PREFETCH_THREAD
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+// The worker prepares the chunks the view is about to reach: it generates their mines, spreads them
+// to fields and counts the mines of the fields that do not need the neighbors, which only depends
+// on the seed of the game. It never touches the chunk table, populate_chunk takes the prepared
+// mines and expand_chunk the prepared fields instead of computing them. The main thread and the
+// worker talk through two single producer, single consumer rings, the positions to prepare and the
+// prepared chunks, so neither one waits for the other.
+// Heads and tails only grow, a ring is full when head - tail is its size.
+
+struct prefetch_request {
+	uint32_t x, y;
+};
+
+// mines and fields of chunk x, y, each ready until the main thread takes it
+struct prefetch_result {
+	uint32_t x, y;
+	uint64_t mines[CHUNK_SIZE];
+	uint8_t fields[CHUNK_SIZE * CHUNK_SIZE];
+	bool mines_ready, fields_ready;
+};
+
+// written by the main thread, read by the worker
+static struct prefetch_request requests[PREFETCH_REQUESTS];
+static _Atomic uint32_t requests_head = 0, requests_tail = 0;
+
+// written by the worker, read by the main thread
+static struct prefetch_result results[PREFETCH_RESULTS];
+static _Atomic uint32_t results_head = 0, results_tail = 0;
+
+static pthread_t worker;
+// game the worker prepares chunks for, it only reads its seed and mine threshold
+static struct game *worker_game;
+// posted once for every request and to stop the worker
+static sem_t wakeup;
+static atomic_bool stopping;
+static bool running = false;
+
+static void *run_worker(void *arg) {
+	struct prefetch_request request;
+	struct prefetch_result *result;
+	uint32_t tail, head;
+
+	(void)arg;
+
+	trace_thread_name("prefetch");
+
+	while (!atomic_load(&stopping)) {
+		if (sem_wait(&wakeup) != 0) {
+			continue;
+		}
+
+		tail = atomic_load_explicit(&requests_tail, memory_order_relaxed);
+		if (tail == atomic_load_explicit(&requests_head, memory_order_acquire)) {
+			continue;
+		}
+
+		request = requests[tail % PREFETCH_REQUESTS];
+		atomic_store_explicit(&requests_tail, tail + 1, memory_order_release);
+
+		// the main thread drops old results before the ring is full, a request that does not fit
+		// is dropped and the chunk is populated by the main thread
+		head = atomic_load_explicit(&results_head, memory_order_relaxed);
+		if (head - atomic_load_explicit(&results_tail, memory_order_acquire) >= PREFETCH_RESULTS) {
+			continue;
+		}
+
+		result = &results[head % PREFETCH_RESULTS];
+		result->x = request.x;
+		result->y = request.y;
+		prepare_chunk(worker_game, request.x, request.y, result->mines, result->fields);
+		result->mines_ready = result->fields_ready = true;
+
+		atomic_store_explicit(&results_head, head + 1, memory_order_release);
+	}
+
+	return NULL;
+}
+
+void start_prefetch(struct game *game) {
+	if (running) {
+		return;
+	}
+
+	atomic_store(&requests_head, 0);
+	atomic_store(&requests_tail, 0);
+	atomic_store(&results_head, 0);
+	atomic_store(&results_tail, 0);
+	atomic_store(&stopping, false);
+	worker_game = game;
+
+	if (sem_init(&wakeup, 0, 0) != 0) {
+		printf("Could not start the prefetch worker, chunks are populated when they are created\n");
+		return;
+	}
+
+	if (pthread_create(&worker, NULL, run_worker, NULL) != 0) {
+		printf("Could not start the prefetch worker, chunks are populated when they are created\n");
+		sem_destroy(&wakeup);
+		return;
+	}
+
+	running = true;
+}
+
+void stop_prefetch() {
+	if (!running) {
+		return;
+	}
+
+	atomic_store(&stopping, true);
+	sem_post(&wakeup);
+	pthread_join(worker, NULL);
+	sem_destroy(&wakeup);
+
+	running = false;
+}
+
+// Queues chunk x, y for the worker, the request is dropped when the queue is full
+void prefetch_chunk(struct game *game, const uint32_t x, const uint32_t y) {
+	uint32_t head, tail;
+
+	if (!running || game != worker_game) {
+		return;
+	}
+
+	// results that were not taken by now are old predictions, they make room for new ones
+	head = atomic_load_explicit(&results_head, memory_order_acquire);
+	tail = atomic_load_explicit(&results_tail, memory_order_relaxed);
+	if (head - tail > PREFETCH_RESULTS / 2) {
+		atomic_store_explicit(&results_tail, head - PREFETCH_RESULTS / 2, memory_order_release);
+	}
+
+	head = atomic_load_explicit(&requests_head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&requests_tail, memory_order_acquire) >= PREFETCH_REQUESTS) {
+		return;
+	}
+
+	requests[head % PREFETCH_REQUESTS].x = x;
+	requests[head % PREFETCH_REQUESTS].y = y;
+	atomic_store_explicit(&requests_head, head + 1, memory_order_release);
+
+	sem_post(&wakeup);
+}
+
+// Returns a result of the worker for the position of c whose fields (or mines) are ready, NULL if
+// there is none
+static struct prefetch_result *find_result(struct game *game, const struct chunk *c,
+										   const bool fields) {
+	struct prefetch_result *p;
+	uint32_t i, head;
+
+	// the mines of other games have other seeds
+	if (!running || game != worker_game) {
+		return NULL;
+	}
+
+	head = atomic_load_explicit(&results_head, memory_order_acquire);
+
+	for (i = atomic_load_explicit(&results_tail, memory_order_relaxed); i != head; i++) {
+		p = &results[i % PREFETCH_RESULTS];
+		if (p->x == c->x && p->y == c->y && (fields ? p->fields_ready : p->mines_ready)) {
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+// results that were taken completely at the tail make room for the worker
+static void drop_taken_results() {
+	uint32_t head, tail;
+
+	head = atomic_load_explicit(&results_head, memory_order_acquire);
+	tail = atomic_load_explicit(&results_tail, memory_order_relaxed);
+
+	while (tail != head && !results[tail % PREFETCH_RESULTS].mines_ready &&
+		   !results[tail % PREFETCH_RESULTS].fields_ready) {
+		tail++;
+	}
+	atomic_store_explicit(&results_tail, tail, memory_order_release);
+}
+
+// Copies the mines the worker prepared for the position of c to c->mines, returns whether there
+// were any
+bool take_prefetched_mines(struct game *game, struct chunk *c) {
+	struct prefetch_result *p;
+
+	p = find_result(game, c, false);
+
+	if (p == NULL) {
+		return false;
+	}
+
+	memcpy(c->mines, p->mines, sizeof(p->mines));
+	p->mines_ready = false;
+	drop_taken_results();
+
+	return true;
+}
+
+// Copies the fields the worker prepared for the position of c to c->fields, returns whether there
+// were any. The mines of the fields that do not need the neighbors are counted already.
+bool take_prefetched_fields(struct game *game, struct chunk *c) {
+	struct prefetch_result *p;
+
+	p = find_result(game, c, true);
+
+	if (p == NULL) {
+		return false;
+	}
+
+	memcpy(c->fields, p->fields, sizeof(p->fields));
+	p->fields_ready = false;
+	drop_taken_results();
+
+	return true;
+}
+
+#else
+
+// without threads the main thread generates the mines of every chunk
+
+void start_prefetch(struct game *game) {}
+
+void stop_prefetch() {}
+
+void prefetch_chunk(struct game *game, const uint32_t x, const uint32_t y) {}
+
+bool take_prefetched_mines(struct game *game, struct chunk *c) {
+	return false;
+}
+
+bool take_prefetched_fields(struct game *game, struct chunk *c) {
+	return false;
+}
+
+#endif
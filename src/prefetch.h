@@ -0,0 +1,31 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include "chunk.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// the worker thread needs pthreads, the web build only has them when it is built with -pthread
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+#define PREFETCH_THREAD
+#endif
+
+// number of chunk positions the main thread can queue for the worker
+#define PREFETCH_REQUESTS 256
+// number of prepared chunks waiting to be created, must be a power of two
+#define PREFETCH_RESULTS 64
+// the view is predicted this many frames ahead from the pan velocity
+#define PREFETCH_FRAMES 8
+
+void start_prefetch(struct game *game);
+
+void stop_prefetch();
+
+void prefetch_chunk(struct game *game, const uint32_t x, const uint32_t y);
+
+bool take_prefetched_mines(struct game *game, struct chunk *c);
+
+bool take_prefetched_fields(struct game *game, struct chunk *c);
+
+#endif
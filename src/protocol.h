@@ -0,0 +1,81 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+// Protocol of the game server (see server.c) over a Unix stream socket. A message is a type byte
+// followed by the body of that type, the bodies are packed structs with little endian integers.
+// The first request of a client is MSG_JOIN. Every request gets one reply, in the order of the
+// requests, the changes of a subscription (MSG_CHANGED) are sent in between.
+#define SERVER_SOCKET "minesweeper.sock"
+
+_Static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "messages are sent as in memory");
+
+// requests
+#define MSG_JOIN 0x01
+#define MSG_UNCOVER 0x02
+#define MSG_FLAG 0x03
+#define MSG_REGION 0x04
+#define MSG_SUBSCRIBE 0x05
+
+// replies
+#define MSG_JOINED 0x81
+#define MSG_RESULT 0x82
+#define MSG_FIELDS 0x83
+#define MSG_CHANGED 0x84
+#define MSG_ERROR 0x85
+
+// a region is at most REGION_SIZE_MAX fields wide and high
+#define REGION_SIZE_MAX 64
+
+// state of a field in MSG_FIELDS and MSG_CHANGED, 0 to 8 is an uncovered field with that many
+// mines around it
+#define FIELD_STATE_COVERED 9
+#define FIELD_STATE_FLAG 10
+// uncovered mine, or every mine when the game is lost
+#define FIELD_STATE_MINE 11
+// uncovered field whose mines can not be counted yet, a neighbor chunk is not in a view
+#define FIELD_STATE_UNKNOWN 12
+
+// the session of MSG_JOIN does not exist, the client can join again
+#define ERROR_SESSION 1
+// unknown message or a region that is too large, the server closes the connection
+#define ERROR_REQUEST 2
+
+// field fx, fy of chunk cx, cy
+struct proto_pos {
+	uint32_t cx, cy;
+	uint8_t fx, fy;
+} __attribute__((packed));
+
+// w * h fields from pos to the right and down, across chunks
+struct proto_rect {
+	struct proto_pos pos;
+	uint8_t w, h;
+} __attribute__((packed));
+
+// MSG_JOIN: session 0 starts a new game with seed, otherwise the client joins that game and seed
+// is ignored. MSG_JOINED: the session and seed of the game.
+struct proto_join {
+	uint32_t session, seed;
+} __attribute__((packed));
+
+// MSG_UNCOVER and MSG_FLAG: struct proto_pos, answered with MSG_RESULT
+struct proto_result {
+	uint8_t dead;
+} __attribute__((packed));
+
+// MSG_REGION: struct proto_rect, answered with MSG_FIELDS. The client looks at the chunks of the
+// region from now on, flood fills only spread into chunks a client of the session looks at.
+// MSG_SUBSCRIBE: struct proto_rect, like MSG_REGION, and every change of a field in the rect is
+// sent as MSG_CHANGED. A rect with w 0 unsubscribes and is answered with MSG_RESULT.
+// MSG_FIELDS and MSG_CHANGED: struct proto_rect followed by the states of the fields row by row,
+// two per byte, the first one in the low nibble (see FIELDS_SIZE).
+#define FIELDS_SIZE(w, h) (((w) * (h) + 1) / 2)
+
+// MSG_ERROR
+struct proto_error {
+	uint8_t code;
+} __attribute__((packed));
+
+#endif
@@ -1,18 +1,31 @@
 #include "renderer.h"
 
 #include "chunk.h"
+#include "evict.h"
 #include "game.h"
+#include "lod.h"
+#include "prefetch.h"
+#include "replay.h"
+#include "save.h"
+#include "stats.h"
+#include "trace.h"
 #include "util.h"
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
+#include <ctype.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
 #endif
 
 static bool run;
+// the game in the window
+static struct game *game;
 
 static SDL_Window *window = NULL;
 static SDL_Renderer *renderer = NULL;
@@ -20,17 +33,96 @@ static SDL_Rect texture_srcrect = {0, 0, TEXTURE_SIZE, TEXTURE_SIZE},
 				texture_dstrect = {0, 0, SQUARE_SIZE_DEFAULT, SQUARE_SIZE_DEFAULT};
 static SDL_Texture *texture;
 
+// Image of the chunk at x, y with TEXTURE_SIZE pixels per field. Every square size is a multiple of
+// TEXTURE_SIZE, so copying it scaled up gives the same pixels as rendering its fields one by one
+// and one texture serves all zoom levels.
+struct chunk_texture {
+	SDL_Texture *texture;
+	uint32_t x, y;
+	// frame in which the texture was last copied to the window
+	uint32_t used;
+};
+
+_Static_assert(SQUARE_SIZE_MIN % TEXTURE_SIZE == 0 && SQUARE_SIZE_STEP % TEXTURE_SIZE == 0,
+			   "chunk textures can not be scaled to every square size");
+
+static struct chunk_texture chunk_textures[CHUNK_TEXTURES];
+static uint32_t frame = 0;
+// false when the renderer can not render to textures, then every field is rendered every frame
+static bool use_chunk_textures = false;
+// whether the chunk textures show the mines of a lost game
+static bool chunk_textures_dead = false;
+
+// Fields are rendered as quads of one vertex buffer that is drawn with a single SDL_RenderGeometry
+// call in flush_fields, instead of one SDL_RenderCopy call per field. Building with -DRENDER_COPY
+// or an SDL without SDL_RenderGeometry (older than 2.0.18) uses SDL_RenderCopy.
+#if SDL_VERSION_ATLEAST(2, 0, 18) && !defined(RENDER_COPY)
+static bool use_render_geometry = true;
+#else
+static bool use_render_geometry = false;
+#endif
+static SDL_Vertex *field_vertices = NULL;
+static int *field_indices = NULL;
+static uint32_t field_quads = 0, field_quads_size = 0;
+
+// time spent rendering and render_chunk calls, printed when the game closes to compare the two
+// ways of rendering fields
+static uint64_t frames = 0, frames_time = 0, chunk_renders = 0;
+
+// The last frame is kept in frame_textures[frame_texture]. Panning copies it shifted into the other
+// texture and only draws the strips that came into view, changed fields only redraw their dirty
+// rectangle (see game->dirty_rects). Without render target support every frame is drawn completely.
+static SDL_Texture *frame_textures[2] = {NULL, NULL};
+static int frame_texture = 0;
+// view of the last frame
+static int64_t frame_view_x, frame_view_y;
+static int frame_w = 0, frame_h = 0, frame_square_size = 0, frame_zoom_out = 0;
+// parts of the window that are drawn in this frame
+static SDL_Rect areas[DIRTY_RECTS + 2];
+static int areas_count;
+
 static int w, h;
 static bool moving = false;
+static bool show_minimap = true;
+
+#ifndef NO_STATS
+// the performance overlay, its lines and the counters and time they were made from
+static bool show_hud = false;
+static char hud_lines[HUD_LINES][HUD_LINE_LENGTH];
+static uint64_t hud_stats[STAT_COUNT];
+static uint32_t hud_time = 0;
+// performance counter ticks spent handling events since the last frame
+static uint64_t event_ticks = 0;
+#endif
+
+// pan of the view in pixels per frame, averaged over the last frames
+static int64_t velocity_x = 0, velocity_y = 0;
+// chunks requested from the prefetch worker in the last frame
+static uint32_t prefetch_x = 0, prefetch_y = 0, prefetch_w = 0, prefetch_h = 0;
+
+// performance counter ticks between two refreshes of the display
+static uint64_t frame_budget;
+// whether the chunks use more memory than allowed, they are evicted by run_deferred_work
+static bool evict_pending = false;
+static uint32_t deferred_frames = 0;
 
 static int init_sdl() {
+	SDL_RendererInfo info;
+	SDL_DisplayMode mode;
+
 	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
 		printf("%s\n", SDL_GetError());
 		return 1;
 	}
 
-	SDL_CreateWindowAndRenderer(WINDOW_WIDTH, WINDOW_HEIGHT, SDL_WINDOW_RESIZABLE, &window,
-								&renderer);
+	// presenting waits for the display, so a frame is not drawn faster than it can be shown, but a
+	// fast replay must not wait
+	SDL_SetHint(SDL_HINT_RENDER_VSYNC, replay_fast() ? "0" : "1");
+
+	// a headless replay still renders every frame, into a hidden window
+	SDL_CreateWindowAndRenderer(WINDOW_WIDTH, WINDOW_HEIGHT,
+								SDL_WINDOW_RESIZABLE | (replay_headless() ? SDL_WINDOW_HIDDEN : 0),
+								&window, &renderer);
 	if (window == NULL || renderer == NULL) {
 		printf("%s\n", SDL_GetError());
 		return 1;
@@ -38,6 +130,15 @@ static int init_sdl() {
 
 	SDL_SetWindowTitle(window, WINDOW_TITLE);
 
+	if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) != 0 ||
+		mode.refresh_rate <= 0) {
+		mode.refresh_rate = DEFAULT_REFRESH_RATE;
+	}
+	frame_budget = SDL_GetPerformanceFrequency() / mode.refresh_rate;
+
+	use_chunk_textures = SDL_GetRendererInfo(renderer, &info) == 0 &&
+						 ISSET(SDL_RENDERER_TARGETTEXTURE, info.flags);
+
 	return 0;
 }
 
@@ -57,7 +158,45 @@ static int init_textures() {
 	return 0;
 }
 
-void cleanup_renderer() {
+static void free_chunk_textures() {
+	uint32_t i;
+
+	for (i = 0; i < CHUNK_TEXTURES; i++) {
+		if (chunk_textures[i].texture != NULL) {
+			SDL_DestroyTexture(chunk_textures[i].texture);
+			chunk_textures[i].texture = NULL;
+		}
+	}
+}
+
+static void print_frame_time() {
+	if (frames > 0) {
+		printf("Rendered %llu frames with %s in %.3f ms per frame, %.1f chunks per frame\n",
+			   (unsigned long long)frames,
+			   use_render_geometry ? "SDL_RenderGeometry" : "SDL_RenderCopy",
+			   frames_time * 1000.0 / SDL_GetPerformanceFrequency() / frames,
+			   (double)chunk_renders / frames);
+	}
+}
+
+static void free_frame_textures() {
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (frame_textures[i] != NULL) {
+			SDL_DestroyTexture(frame_textures[i]);
+			frame_textures[i] = NULL;
+		}
+	}
+}
+
+static void cleanup_renderer() {
+	print_frame_time();
+	print_stats(game, "game");
+	free_chunk_textures();
+	free_frame_textures();
+	free(field_vertices);
+	free(field_indices);
 	if (renderer) {
 		SDL_DestroyRenderer(renderer);
 	}
@@ -81,13 +220,6 @@ static void game_to_screen(const uint32_t cx, const uint32_t cy, const uint32_t
 	*y = game_to_screen_y(cy, fy);
 }
 
-// int_div_round_down(a, 1 << s) == a >> s, where a is an int64_t and s a number valid for bit
-// shifting an int64_t. The return value for values of b that are not powers of two is equivalent
-// but can not be expressed using a bit shift.
-static int64_t int_div_round_down(const int64_t a, const int64_t b) {
-	return a / b - (a < 0 && a % b != 0);
-}
-
 static void screen_to_game(const int x, const int y, uint32_t *cx, uint32_t *cy, uint32_t *fx,
 						   uint32_t *fy) {
 	int64_t gfx, gfy;
@@ -104,25 +236,581 @@ static void screen_to_game(const int x, const int y, uint32_t *cx, uint32_t *cy,
 	}
 }
 
-int is_visible(struct chunk *c) {
+// The chunks inside the window are visible (see visibility_hook), zoomed out no fields are shown
+static bool in_window(const struct chunk *c, void *data) {
 	int x, y;
-	bool visible;
+
+	(void)data;
+
+	if (game->zoom_out > 0) {
+		return false;
+	}
 
 	game_to_screen(c->x, c->y, 0, 0, &x, &y);
 
-	visible = x + game->square_size * CHUNK_SIZE >= 0 && x < w &&
-			  y + game->square_size * CHUNK_SIZE >= 0 && y < h;
+	return x + game->square_size * CHUNK_SIZE >= 0 && x < w &&
+		   y + game->square_size * CHUNK_SIZE >= 0 && y < h;
+}
+
+static void grow_field_quads() {
+	SDL_Vertex *new_vertices;
+	int *new_indices;
+	uint32_t size, i;
+
+	size = field_quads_size ? field_quads_size * 2 : CHUNK_SIZE * CHUNK_SIZE;
+	new_vertices = realloc(field_vertices, sizeof(*field_vertices) * 4 * size);
+	if (new_vertices == NULL) {
+		handle_alloc_error();
+	}
+	field_vertices = new_vertices;
+
+	new_indices = realloc(field_indices, sizeof(*field_indices) * 6 * size);
+	if (new_indices == NULL) {
+		handle_alloc_error();
+	}
+	field_indices = new_indices;
+
+	// two triangles per quad, the vertices are top left, top right, bottom left and bottom right
+	for (i = field_quads_size; i < size; i++) {
+		field_indices[i * 6 + 0] = i * 4 + 0;
+		field_indices[i * 6 + 1] = i * 4 + 1;
+		field_indices[i * 6 + 2] = i * 4 + 2;
+		field_indices[i * 6 + 3] = i * 4 + 2;
+		field_indices[i * 6 + 4] = i * 4 + 1;
+		field_indices[i * 6 + 5] = i * 4 + 3;
+	}
+
+	field_quads_size = size;
+}
+
+// queues texture_srcrect copied to texture_dstrect, like SDL_RenderCopy
+static void push_field_quad() {
+	const float top = (float)texture_srcrect.y / (TEXTURE_SIZE * TEXTURES),
+				bottom = (float)(texture_srcrect.y + TEXTURE_SIZE) / (TEXTURE_SIZE * TEXTURES);
+	const SDL_Color white = {255, 255, 255, 255};
+	SDL_Vertex *v;
+
+	// SDL_RenderCopy renders nothing for a source outside of the texture (unknown mine count)
+	if (texture_srcrect.y < 0) {
+		return;
+	}
+
+	if (field_quads >= field_quads_size) {
+		grow_field_quads();
+	}
+
+	v = &field_vertices[field_quads * 4];
+	v[0].position.x = v[2].position.x = texture_dstrect.x;
+	v[1].position.x = v[3].position.x = texture_dstrect.x + texture_dstrect.w;
+	v[0].position.y = v[1].position.y = texture_dstrect.y;
+	v[2].position.y = v[3].position.y = texture_dstrect.y + texture_dstrect.h;
+	v[0].tex_coord.x = v[2].tex_coord.x = 0;
+	v[1].tex_coord.x = v[3].tex_coord.x = 1;
+	v[0].tex_coord.y = v[1].tex_coord.y = top;
+	v[2].tex_coord.y = v[3].tex_coord.y = bottom;
+	v[0].color = v[1].color = v[2].color = v[3].color = white;
+
+	field_quads++;
+}
+
+// Draws the queued fields to the current render target. When the renderer does not support
+// SDL_RenderGeometry they are copied one by one and SDL_RenderCopy is used from then on.
+static void flush_fields() {
+	uint32_t i;
+
+	if (field_quads == 0) {
+		return;
+	}
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+	if (SDL_RenderGeometry(renderer, texture, field_vertices, field_quads * 4, field_indices,
+						   field_quads * 6) == 0) {
+		field_quads = 0;
+		return;
+	}
+
+	printf("%s, falling back to SDL_RenderCopy\n", SDL_GetError());
+	use_render_geometry = false;
+#endif
+
+	for (i = 0; i < field_quads; i++) {
+		texture_srcrect.y = field_vertices[i * 4].tex_coord.y * (TEXTURE_SIZE * TEXTURES) + 0.5f;
+		texture_dstrect.x = field_vertices[i * 4].position.x;
+		texture_dstrect.y = field_vertices[i * 4].position.y;
+		texture_dstrect.w = texture_dstrect.h =
+			field_vertices[i * 4 + 3].position.x - field_vertices[i * 4].position.x;
+		SDL_RenderCopy(renderer, texture, &texture_srcrect, &texture_dstrect);
+	}
+
+	field_quads = 0;
+}
+
+// Fills rect with color, batched like the fields when SDL_RenderGeometry is used. Queued fields
+// have to be flushed first.
+static void push_color_quad(const SDL_Rect *rect, const SDL_Color color) {
+	SDL_Vertex *v;
+
+	if (!use_render_geometry) {
+		SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+		SDL_RenderFillRect(renderer, rect);
+		return;
+	}
+
+	if (field_quads >= field_quads_size) {
+		grow_field_quads();
+	}
+
+	v = &field_vertices[field_quads * 4];
+	v[0].position.x = v[2].position.x = rect->x;
+	v[1].position.x = v[3].position.x = rect->x + rect->w;
+	v[0].position.y = v[1].position.y = rect->y;
+	v[2].position.y = v[3].position.y = rect->y + rect->h;
+	v[0].tex_coord.x = v[1].tex_coord.x = v[2].tex_coord.x = v[3].tex_coord.x = 0;
+	v[0].tex_coord.y = v[1].tex_coord.y = v[2].tex_coord.y = v[3].tex_coord.y = 0;
+	v[0].color = v[1].color = v[2].color = v[3].color = color;
+
+	field_quads++;
+}
+
+// draws the queued color quads, like flush_fields
+static void flush_color_quads() {
+	SDL_Rect rect;
+	uint32_t i;
+
+	if (field_quads == 0) {
+		return;
+	}
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+	if (SDL_RenderGeometry(renderer, NULL, field_vertices, field_quads * 4, field_indices,
+						   field_quads * 6) == 0) {
+		field_quads = 0;
+		return;
+	}
 
-	if (visible && ISSET(CHUNK_HIT, c->flags)) {
-		UNSET(CHUNK_HIT, c->flags);
+	printf("%s, falling back to SDL_RenderCopy\n", SDL_GetError());
+	use_render_geometry = false;
+#endif
 
-		check_covered_fields(c);
+	for (i = 0; i < field_quads; i++) {
+		rect.x = field_vertices[i * 4].position.x;
+		rect.y = field_vertices[i * 4].position.y;
+		rect.w = field_vertices[i * 4 + 3].position.x - rect.x;
+		rect.h = field_vertices[i * 4 + 3].position.y - rect.y;
+		SDL_SetRenderDrawColor(renderer, field_vertices[i * 4].color.r,
+							   field_vertices[i * 4].color.g, field_vertices[i * 4].color.b, 255);
+		SDL_RenderFillRect(renderer, &rect);
 	}
 
-	return visible;
+	field_quads = 0;
 }
 
-static void render_field(const int x, const int y, const uint8_t field, const int mines) {
+// color of fields fields of which uncovered are uncovered and flags are flagged
+static SDL_Color summary_color(const uint64_t uncovered, const uint64_t flags,
+							   const uint64_t fields) {
+	const uint64_t red = flags * LOD_FLAG_FIELDS < fields ? flags * LOD_FLAG_FIELDS : fields;
+	SDL_Color color;
+	uint32_t grey;
+
+	grey = LOD_COVERED_GREY + (LOD_UNCOVERED_GREY - LOD_COVERED_GREY) * uncovered / fields;
+
+	color.r = grey + (255 - grey) * red / fields;
+	color.g = color.b = grey - grey * red / fields / 2;
+	color.a = 255;
+
+	return color;
+}
+
+// pixels of one chunk zoomed out
+static int64_t zoomed_out_chunk_size() {
+	return (CHUNK_SIZE * SQUARE_SIZE_MIN) >> game->zoom_out;
+}
+
+// the lowest level of the pyramid whose nodes are at least LOD_NODE_SIZE_MIN pixels zoomed out
+static uint32_t zoomed_out_level() {
+	uint32_t level;
+
+	for (level = 0; level < LOD_LEVELS - 1 && zoomed_out_chunk_size() << level < LOD_NODE_SIZE_MIN;
+		 level++) {
+	}
+
+	return level;
+}
+
+// Draws the window zoomed out, loaded chunks from their tiles and everything else from the nodes
+// of the pyramid. The cost only depends on the number of nodes in the window.
+static void render_summaries() {
+	const uint32_t level = zoomed_out_level();
+	const int64_t node_size = zoomed_out_chunk_size() << level,
+				  block_size = zoomed_out_chunk_size() / LOD_TILE_SIZE;
+	const uint64_t node_fields = (uint64_t)CHUNK_SIZE * CHUNK_SIZE << level << level;
+	const struct lod_node *n;
+	int64_t x, y, start_x, start_y;
+	struct chunk *c;
+	SDL_Rect rect;
+	uint32_t i;
+
+	start_x = int_div_round_down(-game->view_x, node_size);
+	start_y = int_div_round_down(-game->view_y, node_size);
+
+	for (y = start_y; y * node_size + game->view_y < h; y++) {
+		for (x = start_x; x * node_size + game->view_x < w; x++) {
+			rect.x = x * node_size + game->view_x;
+			rect.y = y * node_size + game->view_y;
+
+			c = level == 0 && game->zoom_out <= LOD_TILE_ZOOM_OUT_MAX ? find_chunk(game, x, y)
+																	   : NULL;
+			if (c != NULL) {
+				rect.w = rect.h = block_size;
+				for (i = 0; i < LOD_TILE_SIZE * LOD_TILE_SIZE; i++) {
+					if (c->tile[i] != 0) {
+						rect.x = x * node_size + game->view_x + i % LOD_TILE_SIZE * block_size;
+						rect.y = y * node_size + game->view_y + i / LOD_TILE_SIZE * block_size;
+						push_color_quad(&rect, summary_color(c->tile[i], 0,
+															 CHUNK_SIZE * CHUNK_SIZE /
+																 (LOD_TILE_SIZE * LOD_TILE_SIZE)));
+					}
+				}
+				continue;
+			}
+
+			// the node of chunk x << level, with the wrap around of chunk positions
+			n = find_lod_node(game, level, ((uint32_t)x << level) >> level,
+							  ((uint32_t)y << level) >> level);
+			if (n != NULL) {
+				rect.w = rect.h = node_size;
+				push_color_quad(&rect, summary_color(n->uncovered, n->flags, node_fields));
+			}
+		}
+	}
+
+	flush_color_quads();
+}
+
+// Returns the pixels of one cell of the minimap and sets level to the level of its nodes
+static int64_t minimap_node_size(uint32_t *level) {
+	const int64_t chunk_size = game->zoom_out > 0 ? zoomed_out_chunk_size()
+												  : (int64_t)game->square_size * CHUNK_SIZE;
+
+	*level = (game->zoom_out > 0 ? zoomed_out_level() : 0) + MINIMAP_LEVELS;
+	*level = *level < LOD_LEVELS ? *level : LOD_LEVELS - 1;
+
+	return chunk_size << *level;
+}
+
+// Returns the pixels of the minimap in the top right corner of the window
+static SDL_Rect minimap_rect() {
+	const SDL_Rect map = {w - MINIMAP_MARGIN - MINIMAP_CELLS * MINIMAP_CELL_SIZE, MINIMAP_MARGIN,
+						  MINIMAP_CELLS * MINIMAP_CELL_SIZE, MINIMAP_CELLS * MINIMAP_CELL_SIZE};
+
+	return map;
+}
+
+// Draws the minimap on top of the window, MINIMAP_CELLS nodes around the center of the window with
+// a frame around the part that is in the window. A left click in it moves the view there.
+static void render_minimap() {
+	const SDL_Color covered = {LOD_COVERED_GREY, LOD_COVERED_GREY, LOD_COVERED_GREY, 255};
+	const SDL_Rect map = minimap_rect();
+	const struct lod_node *n;
+	uint32_t level, x, y;
+	int64_t node_size, start_x, start_y;
+	SDL_Rect rect, view;
+
+	node_size = minimap_node_size(&level);
+
+	start_x = int_div_round_down(w / 2 - game->view_x, node_size) - MINIMAP_CELLS / 2;
+	start_y = int_div_round_down(h / 2 - game->view_y, node_size) - MINIMAP_CELLS / 2;
+
+	push_color_quad(&map, covered);
+
+	for (y = 0; y < MINIMAP_CELLS; y++) {
+		for (x = 0; x < MINIMAP_CELLS; x++) {
+			n = find_lod_node(game, level, ((uint32_t)(start_x + x) << level) >> level,
+							  ((uint32_t)(start_y + y) << level) >> level);
+			if (n != NULL) {
+				rect.x = map.x + x * MINIMAP_CELL_SIZE;
+				rect.y = map.y + y * MINIMAP_CELL_SIZE;
+				rect.w = rect.h = MINIMAP_CELL_SIZE;
+				push_color_quad(&rect, summary_color(n->uncovered, n->flags,
+													 (uint64_t)CHUNK_SIZE * CHUNK_SIZE << level
+														 << level));
+			}
+		}
+	}
+
+	flush_color_quads();
+
+	// the window, at least one pixel
+	rect.x = map.x + int_div_round_down((-game->view_x - start_x * node_size) * MINIMAP_CELL_SIZE,
+										node_size);
+	rect.y = map.y + int_div_round_down((-game->view_y - start_y * node_size) * MINIMAP_CELL_SIZE,
+										node_size);
+	rect.w = w * MINIMAP_CELL_SIZE / node_size + 1;
+	rect.h = h * MINIMAP_CELL_SIZE / node_size + 1;
+
+	SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+	if (SDL_IntersectRect(&rect, &map, &view)) {
+		SDL_RenderDrawRect(renderer, &view);
+	}
+	SDL_RenderDrawRect(renderer, &map);
+}
+
+static bool in_minimap(const int x, const int y) {
+	const SDL_Rect map = minimap_rect();
+
+	return show_minimap && x >= map.x && x < map.x + map.w && y >= map.y && y < map.y + map.h;
+}
+
+// moves the view so that the point x, y of the minimap is in the center of the window
+static void center_minimap(const int x, const int y) {
+	const SDL_Rect map = minimap_rect();
+	int64_t node_size;
+	uint32_t level;
+
+	node_size = minimap_node_size(&level);
+
+	// the center of the window is in the center cell of the minimap (see render_minimap)
+	game->view_x -= (x - map.x - map.w / 2) * node_size / MINIMAP_CELL_SIZE;
+	game->view_y -= (y - map.y - map.h / 2) * node_size / MINIMAP_CELL_SIZE;
+}
+
+// Zooms out by -zoom levels (in for a positive zoom) below the smallest square size, the point of
+// the game under x, y stays where it is
+static void zoom_summaries(const int x, const int y, const int zoom) {
+	int zoom_out;
+
+	zoom_out = game->zoom_out - zoom;
+	if (zoom_out > LOD_ZOOM_OUT_MAX) {
+		zoom_out = LOD_ZOOM_OUT_MAX;
+	} else if (zoom_out < 0) {
+		zoom_out = 0;
+	}
+
+	// every level halves the size of a chunk
+	if (zoom_out > game->zoom_out) {
+		game->view_x =
+			x - int_div_round_down(x - game->view_x, (int64_t)1 << (zoom_out - game->zoom_out));
+		game->view_y =
+			y - int_div_round_down(y - game->view_y, (int64_t)1 << (zoom_out - game->zoom_out));
+	} else {
+		game->view_x = x - (x - game->view_x) * ((int64_t)1 << (game->zoom_out - zoom_out));
+		game->view_y = y - (y - game->view_y) * ((int64_t)1 << (game->zoom_out - zoom_out));
+	}
+
+	game->zoom_out = zoom_out;
+	game->dirty = 1;
+}
+
+// Zooms in by zoom square size steps (out for a negative zoom), the point of the game under x, y
+// stays where it is
+static void zoom_squares(const int x, const int y, const int zoom) {
+	int prev_square_size, new_square_size;
+
+	prev_square_size = game->square_size;
+
+	new_square_size = prev_square_size + zoom * SQUARE_SIZE_STEP;
+	if (new_square_size > SQUARE_SIZE_MAX) {
+		new_square_size = SQUARE_SIZE_MAX;
+	} else if (new_square_size < SQUARE_SIZE_MIN) {
+		new_square_size = SQUARE_SIZE_MIN;
+	}
+
+	game->view_x =
+		x - int_div_round_down(new_square_size * (x - game->view_x), prev_square_size);
+	game->view_y =
+		y - int_div_round_down(new_square_size * (y - game->view_y), prev_square_size);
+
+	game->square_size = new_square_size;
+	game->dirty = 1;
+}
+
+// Zooms in by zoom steps of the mouse wheel (out for a negative zoom) at x, y. Below the smallest
+// square size chunks are drawn from their summaries, the steps that zoom past it continue there.
+static void zoom_view(const int x, const int y, int zoom) {
+	int steps;
+
+	if (zoom > 0 && game->zoom_out > 0) {
+		steps = zoom < game->zoom_out ? zoom : game->zoom_out;
+		zoom_summaries(x, y, steps);
+		zoom -= steps;
+	}
+
+	if (zoom < 0 && game->zoom_out == 0) {
+		// rounded up, the square size is clamped to the smallest one
+		steps = -((game->square_size - SQUARE_SIZE_MIN + SQUARE_SIZE_STEP - 1) / SQUARE_SIZE_STEP);
+		if (steps < zoom) {
+			steps = zoom;
+		}
+		if (steps < 0) {
+			zoom_squares(x, y, steps);
+			zoom -= steps;
+		}
+	} else if (zoom > 0) {
+		zoom_squares(x, y, zoom);
+		zoom = 0;
+	}
+
+	if (zoom < 0) {
+		zoom_summaries(x, y, zoom);
+	}
+}
+
+#ifndef NO_STATS
+// 3x5 pixel glyphs, one octal digit per row from the top, the high bit of a digit is the left
+// pixel. Lower case letters are drawn as upper case ones, other characters are blank.
+static const uint16_t hud_font[128] = {
+	['0'] = 075557, ['1'] = 026227, ['2'] = 071747, ['3'] = 071717, ['4'] = 055711,
+	['5'] = 074717, ['6'] = 074757, ['7'] = 071111, ['8'] = 075757, ['9'] = 075717,
+	['A'] = 025755, ['B'] = 065656, ['C'] = 034443, ['D'] = 065556, ['E'] = 074647,
+	['F'] = 074644, ['G'] = 034553, ['H'] = 055755, ['I'] = 072227, ['J'] = 011152,
+	['K'] = 055655, ['L'] = 044447, ['M'] = 057755, ['N'] = 065555, ['O'] = 025552,
+	['P'] = 065644, ['Q'] = 025563, ['R'] = 065655, ['S'] = 034216, ['T'] = 072222,
+	['U'] = 055557, ['V'] = 055552, ['W'] = 055775, ['X'] = 055255, ['Y'] = 055222,
+	['Z'] = 071247, ['.'] = 000002, ['/'] = 011244, [':'] = 002020, ['-'] = 000700,
+	['%'] = 051245,
+};
+
+static uint64_t ticks_to_ns(const uint64_t ticks) {
+	return (double)ticks * 1e9 / SDL_GetPerformanceFrequency();
+}
+
+// Counts a frame that started at start, was presented at present and ended at end, the events
+// handled since the last frame belong to it
+static void count_frame(const uint64_t start, const uint64_t present, const uint64_t end) {
+	STAT_ADD(STAT_FRAMES, 1);
+	STAT_ADD(STAT_EVENT_NS, ticks_to_ns(event_ticks));
+	STAT_ADD(STAT_RENDER_NS, ticks_to_ns(present - start));
+	STAT_ADD(STAT_PRESENT_NS, ticks_to_ns(end - present));
+	event_ticks = 0;
+}
+
+// Makes the lines of the overlay from the counters of the last HUD_INTERVAL_MS, returns whether
+// they changed
+static bool update_hud() {
+	uint64_t stats[STAT_COUNT], d[STAT_COUNT];
+	double seconds, frames;
+	uint32_t now;
+	int i;
+
+	now = SDL_GetTicks();
+	if (!show_hud || now - hud_time < HUD_INTERVAL_MS) {
+		return false;
+	}
+
+	read_stats(game, stats);
+	for (i = 0; i < STAT_COUNT; i++) {
+		d[i] = stats[i] - hud_stats[i];
+	}
+
+	seconds = (now - hud_time) / 1000.0;
+	// times are per frame, there may have been no frame while nothing changed
+	frames = d[STAT_FRAMES] > 0 ? d[STAT_FRAMES] : 1;
+
+	i = 0;
+	snprintf(hud_lines[i++], HUD_LINE_LENGTH, "frames/s %.1f", d[STAT_FRAMES] / seconds);
+	snprintf(hud_lines[i++], HUD_LINE_LENGTH, "frame %.2f ms",
+			 (d[STAT_EVENT_NS] + d[STAT_RENDER_NS] + d[STAT_PRESENT_NS]) / 1e6 / frames);
+	snprintf(hud_lines[i++], HUD_LINE_LENGTH, " event %.2f ms", d[STAT_EVENT_NS] / 1e6 / frames);
+	snprintf(hud_lines[i++], HUD_LINE_LENGTH, " render %.2f ms", d[STAT_RENDER_NS] / 1e6 / frames);
+	snprintf(hud_lines[i++], HUD_LINE_LENGTH, " present %.2f ms",
+			 d[STAT_PRESENT_NS] / 1e6 / frames);
+	snprintf(hud_lines[i++], HUD_LINE_LENGTH, "lookups/s %.0f", d[STAT_CHUNK_LOOKUPS] / seconds);
+	snprintf(hud_lines[i++], HUD_LINE_LENGTH, "created/s %.0f", d[STAT_CHUNKS_CREATED] / seconds);
+	snprintf(hud_lines[i++], HUD_LINE_LENGTH, "populated/s %.0f",
+			 d[STAT_CHUNKS_POPULATED] / seconds);
+	snprintf(hud_lines[i++], HUD_LINE_LENGTH, "prefetched/s %.0f",
+			 d[STAT_CHUNKS_PREFETCHED] / seconds);
+	snprintf(hud_lines[i++], HUD_LINE_LENGTH, "mine counts %llu/%llu cached",
+			 (unsigned long long)d[STAT_MINES_HITS],
+			 (unsigned long long)(d[STAT_MINES_HITS] + d[STAT_MINES_MISSES]));
+	snprintf(hud_lines[i++], HUD_LINE_LENGTH, "last fill %llu cells",
+			 (unsigned long long)stats[STAT_LAST_FILL_CELLS]);
+	snprintf(hud_lines[i++], HUD_LINE_LENGTH, "chunks %llu",
+			 (unsigned long long)stats[STAT_CHUNKS_LIVE]);
+	snprintf(hud_lines[i++], HUD_LINE_LENGTH, " with mines %llu",
+			 (unsigned long long)stats[STAT_CHUNKS_MINES]);
+	snprintf(hud_lines[i++], HUD_LINE_LENGTH, " with fields %llu",
+			 (unsigned long long)stats[STAT_CHUNKS_FIELDS]);
+	snprintf(hud_lines[i++], HUD_LINE_LENGTH, "chunk memory %.1f mib",
+			 stats[STAT_CHUNK_BYTES] / (1024.0 * 1024.0));
+
+	memcpy(hud_stats, stats, sizeof(stats));
+	hud_time = now;
+
+	return true;
+}
+
+// draws text with its top left corner at x, y
+static void draw_hud_text(const char *text, const int x, const int y) {
+	const SDL_Color white = {255, 255, 255, 255};
+	SDL_Rect rect = {0, 0, HUD_PIXEL_SIZE, HUD_PIXEL_SIZE};
+	uint16_t glyph;
+	int i, row, col;
+
+	for (i = 0; text[i] != '\0'; i++) {
+		glyph = hud_font[toupper((unsigned char)text[i]) & 127];
+
+		for (row = 0; row < 5; row++) {
+			for (col = 0; col < 3; col++) {
+				if (glyph >> ((4 - row) * 3 + 2 - col) & 1) {
+					rect.x = x + (i * 4 + col) * HUD_PIXEL_SIZE;
+					rect.y = y + row * HUD_PIXEL_SIZE;
+					push_color_quad(&rect, white);
+				}
+			}
+		}
+	}
+}
+
+// Draws the overlay in the top left corner on top of the frame, with one batch of color quads
+static void render_hud() {
+	const SDL_Color black = {0, 0, 0, 255};
+	SDL_Rect rect;
+	size_t length;
+	int i;
+
+	if (!show_hud) {
+		return;
+	}
+
+	length = 0;
+	for (i = 0; i < HUD_LINES; i++) {
+		length = strlen(hud_lines[i]) > length ? strlen(hud_lines[i]) : length;
+	}
+
+	// every character is 4 pixels wide and every line 6 pixels high, with the space after it
+	rect.x = HUD_MARGIN;
+	rect.y = HUD_MARGIN;
+	rect.w = (length * 4 + 1) * HUD_PIXEL_SIZE;
+	rect.h = (HUD_LINES * 6 + 1) * HUD_PIXEL_SIZE;
+	push_color_quad(&rect, black);
+
+	for (i = 0; i < HUD_LINES; i++) {
+		draw_hud_text(hud_lines[i], HUD_MARGIN + HUD_PIXEL_SIZE,
+					  HUD_MARGIN + (i * 6 + 1) * HUD_PIXEL_SIZE);
+	}
+
+	flush_color_quads();
+}
+
+static void toggle_hud() {
+	show_hud = !show_hud;
+
+	// the first lines are made after HUD_INTERVAL_MS
+	memset(hud_lines, 0, sizeof(hud_lines));
+	read_stats(game, hud_stats);
+	hud_time = SDL_GetTicks();
+}
+#else
+static bool update_hud() {
+	return false;
+}
+
+static void render_hud() {}
+#endif
+
+static void render_field(const int x, const int y, const int size, const uint8_t field,
+						 const int mines) {
 	if (ISSET(FIELD_FLAG, field)) {
 		if (game->dead && !ISSET(FIELD_MINE, field)) {
 			texture_srcrect.y = TEXTURE_FLAG_WRONG * TEXTURE_SIZE;
@@ -143,91 +831,459 @@ static void render_field(const int x, const int y, const uint8_t field, const in
 
 	texture_dstrect.x = x;
 	texture_dstrect.y = y;
+	texture_dstrect.w = texture_dstrect.h = size;
 
-	SDL_RenderCopy(renderer, texture, &texture_srcrect, &texture_dstrect);
+	if (use_render_geometry) {
+		push_field_quad();
+	} else {
+		SDL_RenderCopy(renderer, texture, &texture_srcrect, &texture_dstrect);
+	}
 }
 
-static void render_chunk(struct chunk *c) {
-	struct chunk *next;
-	int x, y, sx, sy;
+// Renders field fx, fy of c at x, y. Only uncovered fields and all fields of a lost game show their
+// mine count, the covered fields of a chunk without fields need neither its fields nor its mines.
+static void render_chunk_field(const int x, const int y, const int size, struct chunk *c,
+							   const uint32_t fx, const uint32_t fy) {
+	int mines;
 
-	for (y = 0; y < CHUNK_SIZE; y++) {
-		sy = game_to_screen_y(c->y, y);
+	mines = 0;
+	if (game->dead || (c->fields != NULL && ISSET(FIELD_UNCOVERED, c->fields[POS(fx, fy)]))) {
+		mines = field_get_mines(game, c, fx, fy);
+	}
 
-		if (sy < -game->square_size) {
-			continue;
-		} else if (sy > game->square_size + h) {
-			break;
-		}
+	render_field(x, y, size, c->fields != NULL ? c->fields[POS(fx, fy)] : 0, mines);
+}
+
+static void draw_chunk_texture(struct chunk *c, SDL_Texture *target) {
+	SDL_Texture *prev_target;
+	uint32_t x, y;
 
+	// counting the mines can change fields of c, they are drawn again in the next frame then
+	UNSET(CHUNK_CHANGED, c->flags);
+
+	// the fields queued so far belong to the frame
+	flush_fields();
+	prev_target = SDL_GetRenderTarget(renderer);
+	SDL_SetRenderTarget(renderer, target);
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+	SDL_RenderClear(renderer);
+
+	for (y = 0; y < CHUNK_SIZE; y++) {
 		for (x = 0; x < CHUNK_SIZE; x++) {
-			sx = game_to_screen_x(c->x, x);
+			render_chunk_field(x * TEXTURE_SIZE, y * TEXTURE_SIZE, TEXTURE_SIZE, c, x, y);
+		}
+	}
 
-			if (sx < -game->square_size) {
-				continue;
-			} else if (sx > game->square_size + w) {
-				break;
+	flush_fields();
+	SDL_SetRenderTarget(renderer, prev_target);
+}
+
+// Returns the texture of the visible chunk c, it is only drawn again when fields of c changed.
+// Without a texture for c it takes the least recently used one of a chunk that is not in the
+// window. Returns NULL when all textures are in the window or no texture can be created.
+static SDL_Texture *get_chunk_texture(struct chunk *c) {
+	struct chunk_texture *t, *lru;
+	uint32_t i;
+
+	lru = NULL;
+	for (i = 0; i < CHUNK_TEXTURES; i++) {
+		t = &chunk_textures[i];
+
+		if (t->texture != NULL && t->x == c->x && t->y == c->y) {
+			if (ISSET(CHUNK_CHANGED, c->flags)) {
+				draw_chunk_texture(c, t->texture);
 			}
+			t->used = frame;
+			return t->texture;
+		}
+
+		if (lru == NULL ||
+			(lru->texture != NULL && (t->texture == NULL || frame - t->used > frame - lru->used))) {
+			lru = t;
+		}
+	}
 
-			render_field(sx, sy, c->fields[POS(x, y)], field_get_mines(c, x, y));
+	if (lru->texture == NULL) {
+		lru->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+										 SDL_TEXTUREACCESS_TARGET, CHUNK_SIZE * TEXTURE_SIZE,
+										 CHUNK_SIZE * TEXTURE_SIZE);
+		if (lru->texture == NULL) {
+			return NULL;
 		}
+	} else if (lru->used == frame) {
+		return NULL;
 	}
 
+	lru->x = c->x;
+	lru->y = c->y;
+	lru->used = frame;
+	draw_chunk_texture(c, lru->texture);
+
+	return lru->texture;
+}
+
+// Renders the fields of c in part, part is inside of the chunk at rect on the screen. The fields
+// that are partly in part are rendered completely, they look the same outside of part.
+static void render_chunk_part(struct chunk *c, const SDL_Rect *rect, const SDL_Rect *part) {
+	SDL_Texture *chunk_texture;
+	SDL_Rect src, dst;
+	int x, y, min_x, min_y, max_x, max_y;
+
+	min_x = (part->x - rect->x) / game->square_size;
+	min_y = (part->y - rect->y) / game->square_size;
+	max_x = (part->x + part->w - 1 - rect->x) / game->square_size;
+	max_y = (part->y + part->h - 1 - rect->y) / game->square_size;
+
+	chunk_texture = use_chunk_textures ? get_chunk_texture(c) : NULL;
+
+	if (chunk_texture != NULL) {
+		src.x = min_x * TEXTURE_SIZE;
+		src.y = min_y * TEXTURE_SIZE;
+		src.w = (max_x - min_x + 1) * TEXTURE_SIZE;
+		src.h = (max_y - min_y + 1) * TEXTURE_SIZE;
+		dst.x = rect->x + min_x * game->square_size;
+		dst.y = rect->y + min_y * game->square_size;
+		dst.w = (max_x - min_x + 1) * game->square_size;
+		dst.h = (max_y - min_y + 1) * game->square_size;
+		SDL_RenderCopy(renderer, chunk_texture, &src, &dst);
+		return;
+	}
+
+	for (y = min_y; y <= max_y; y++) {
+		for (x = min_x; x <= max_x; x++) {
+			render_chunk_field(rect->x + x * game->square_size, rect->y + y * game->square_size,
+							   game->square_size, c, x, y);
+		}
+	}
+}
+
+static void render_chunk(struct chunk *c) {
+	SDL_Rect rect, part;
+	int i;
+
+	// checks the covered fields of chunks that come into view
+	if (!is_visible(game, c)) {
+		return;
+	}
+
+	TRACE_BEGIN(start);
+
+	game_to_screen(c->x, c->y, 0, 0, &rect.x, &rect.y);
+	rect.w = rect.h = game->square_size * CHUNK_SIZE;
+
+	for (i = 0; i < areas_count; i++) {
+		if (SDL_IntersectRect(&rect, &areas[i], &part)) {
+			chunk_renders++;
+			render_chunk_part(c, &rect, &part);
+		}
+	}
+
+	TRACE_END(start, "render_chunk", "x", c->x, "y", c->y);
+
 	// debug chunk borders
 	// game_to_screen(c->x, c->y, 0, 0, &sx, &sy);
 	// SDL_SetRenderDrawColor(renderer, (c->x || c->y) * 0xff, 0, 0, 0xff);
 	// SDL_RenderDrawLine(renderer, sx, sy, sx + game->square_size * CHUNK_SIZE, sy);
 	// SDL_RenderDrawLine(renderer, sx, sy, sx, sy + game->square_size * CHUNK_SIZE);
+}
 
-	next = get_neighbor(c, 1, 0);
-	if (next != NULL) {
-		render_chunk(next);
+// Walks the cols * rows chunks in the window once each, row is the chunk in the top left corner.
+// The rows are walked with the neighbor links, so there are no hash table lookups. Only the chunks
+// in the areas are rendered, but all of them are marked as used, so none of them is evicted while
+// the next frame still starts from one of them (see render_fields).
+static void render_chunks(struct chunk *row, const uint32_t cols, const uint32_t rows) {
+	struct chunk *c;
+	uint32_t i, j;
+
+	for (j = 0; j < rows && row != NULL; j++) {
+		c = row;
+		for (i = 0; i < cols && c != NULL; i++) {
+			// get_neighbor marks the others too, but not a window of one chunk
+			c->used = game->tick;
+			render_chunk(c);
+			c = i + 1 < cols ? get_neighbor(game, c, 1, 0) : NULL;
+		}
+		row = j + 1 < rows ? get_neighbor(game, row, 0, 1) : NULL;
 	}
-	next = get_neighbor(c, 0, 1);
-	if (next != NULL) {
-		render_chunk(next);
+}
+
+// adds the part of rect that is in the window to the areas of this frame
+static void add_area(const SDL_Rect *rect) {
+	const SDL_Rect window_rect = {0, 0, w, h};
+
+	if (SDL_IntersectRect(rect, &window_rect, &areas[areas_count])) {
+		areas_count++;
 	}
 }
 
-static void render() {
-	static struct chunk *c = NULL;
-	uint32_t x, y;
-	int32_t dx, dy;
+// Sets the render target of this frame and the areas that have to be drawn in it. Returns the frame
+// texture, or NULL when the frame is drawn to the window directly.
+static SDL_Texture *begin_frame() {
+	const int64_t pan_x = game->view_x - frame_view_x, pan_y = game->view_y - frame_view_y;
+	const struct dirty_rect *r;
+	SDL_Rect rect;
+	uint32_t i;
+	bool full;
 
-	if (game->dirty) {
-		SDL_GetWindowSize(window, &w, &h);
+	// zoomed out frames are cheap, they are always drawn completely
+	full = game->dirty || w != frame_w || h != frame_h || game->square_size != frame_square_size ||
+		   game->zoom_out != frame_zoom_out || game->zoom_out > 0 || pan_x <= -w || pan_x >= w ||
+		   pan_y <= -h || pan_y >= h;
 
-		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-		SDL_RenderClear(renderer);
+	if (use_chunk_textures && (w != frame_w || h != frame_h)) {
+		free_frame_textures();
+		for (i = 0; i < 2; i++) {
+			frame_textures[i] = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+												  SDL_TEXTUREACCESS_TARGET, w, h);
+		}
+		if (frame_textures[0] == NULL || frame_textures[1] == NULL) {
+			free_frame_textures();
+		}
+	}
 
-		screen_to_game(0, 0, &x, &y, NULL, NULL);
+	areas_count = 0;
 
-		if (c == NULL) {
-			// first time rendering
-			c = get_chunk_by_pos(x, y, true);
-		} else {
-			dx = x - c->x;
-			dy = y - c->y;
-			if (dx == 0 && dy == 0) {
-				// no lookup, we got the right chunk already
-				// most of the time the previous frame started with the same chunk
-			} else if (dx >= -1 && dx <= 1 && dy >= -1 && dy <= 1) {
-				// O(1) lookup, we moved less than one chunk between two frames
-				// every time we move the screen origin (0, 0) over a chunk boundary
-				c = c->neighbors[NPOS(dx, dy)];
-			} else {
-				// O(n) lookup, we moved *over* a chunk
-				// is is super rare
-				c = get_chunk_by_pos(x, y, true);
+	if (full || frame_textures[0] == NULL) {
+		rect.x = rect.y = 0;
+		rect.w = w;
+		rect.h = h;
+		add_area(&rect);
+	} else {
+		// the pixels that stay in the window move with the view
+		SDL_SetRenderTarget(renderer, frame_textures[!frame_texture]);
+		rect.x = pan_x;
+		rect.y = pan_y;
+		rect.w = w;
+		rect.h = h;
+		SDL_RenderCopy(renderer, frame_textures[frame_texture], NULL, &rect);
+		frame_texture = !frame_texture;
+
+		// the strips that came into view
+		if (pan_x != 0) {
+			rect.x = pan_x > 0 ? 0 : w + pan_x;
+			rect.y = 0;
+			rect.w = pan_x > 0 ? pan_x : -pan_x;
+			rect.h = h;
+			add_area(&rect);
+		}
+		if (pan_y != 0) {
+			rect.x = 0;
+			rect.y = pan_y > 0 ? 0 : h + pan_y;
+			rect.w = w;
+			rect.h = pan_y > 0 ? pan_y : -pan_y;
+			add_area(&rect);
+		}
+
+		for (i = 0; i < game->dirty_rects_count; i++) {
+			r = &game->dirty_rects[i];
+			game_to_screen(r->x, r->y, r->min_x, r->min_y, &rect.x, &rect.y);
+			rect.w = (r->max_x - r->min_x + 1) * game->square_size;
+			rect.h = (r->max_y - r->min_y + 1) * game->square_size;
+			add_area(&rect);
+		}
+	}
+
+	// fields that change while this frame is rendered are drawn in the next one
+	game->dirty = 0;
+	game->dirty_rects_count = 0;
+
+	frame_view_x = game->view_x;
+	frame_view_y = game->view_y;
+	frame_w = w;
+	frame_h = h;
+	frame_square_size = game->square_size;
+	frame_zoom_out = game->zoom_out;
+
+	SDL_SetRenderTarget(renderer, frame_textures[frame_texture]);
+
+	return frame_textures[frame_texture];
+}
+
+// Asks the prefetch worker for the chunks the window reaches in the next PREFETCH_FRAMES frames if
+// the view keeps panning like this, and the chunks around them the mine counts of their edges need
+static void prefetch_view() {
+	uint32_t x, y, end_x, end_y, cx, cy;
+	int64_t ahead_x, ahead_y;
+	struct chunk *c;
+
+	// zooming moves the view by a lot at once, zoomed out no chunks are needed
+	if (game->square_size != frame_square_size || game->zoom_out != frame_zoom_out ||
+		game->zoom_out > 0) {
+		velocity_x = velocity_y = 0;
+		return;
+	}
+
+	velocity_x = (velocity_x * 3 + game->view_x - frame_view_x) / 4;
+	velocity_y = (velocity_y * 3 + game->view_y - frame_view_y) / 4;
+
+	// the view moves right when the game moves left, new chunks come in from the left
+	ahead_x = -velocity_x * PREFETCH_FRAMES;
+	ahead_y = -velocity_y * PREFETCH_FRAMES;
+
+	screen_to_game(ahead_x < 0 ? ahead_x : 0, ahead_y < 0 ? ahead_y : 0, &x, &y, NULL, NULL);
+	screen_to_game(ahead_x > 0 ? w - 1 + ahead_x : w - 1, ahead_y > 0 ? h - 1 + ahead_y : h - 1,
+				   &end_x, &end_y, NULL, NULL);
+
+	x--;
+	y--;
+	end_x++;
+	end_y++;
+
+	for (cy = y; cy != end_y + 1; cy++) {
+		for (cx = x; cx != end_x + 1; cx++) {
+			// chunks next to uncovered ones exist before they are populated
+			c = find_chunk(game, cx, cy);
+			if ((cx - prefetch_x >= prefetch_w || cy - prefetch_y >= prefetch_h) &&
+				(c == NULL || !ISSET(CHUNK_POPULATED, c->flags))) {
+				prefetch_chunk(game, cx, cy);
 			}
 		}
+	}
+
+	prefetch_x = x;
+	prefetch_y = y;
+	prefetch_w = end_x - x + 1;
+	prefetch_h = end_y - y + 1;
+}
+
+// Draws the fields in the window, c is the chunk in the top left corner of the last frame or NULL.
+// Returns the one of this frame.
+static struct chunk *render_fields(struct chunk *c) {
+	uint32_t x, y, end_x, end_y;
+	int32_t dx, dy;
+
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+	SDL_RenderFillRects(renderer, areas, areas_count);
+
+	screen_to_game(0, 0, &x, &y, NULL, NULL);
+	screen_to_game(w - 1, h - 1, &end_x, &end_y, NULL, NULL);
+
+	if (c == NULL) {
+		// first time rendering
+		c = get_chunk_by_pos(game, x, y, true);
+	} else {
+		dx = x - c->x;
+		dy = y - c->y;
+		if (dx == 0 && dy == 0) {
+			// no lookup, we got the right chunk already
+			// most of the time the previous frame started with the same chunk
+		} else if (dx >= -1 && dx <= 1 && dy >= -1 && dy <= 1) {
+			// O(1) lookup, we moved less than one chunk between two frames
+			// every time we move the screen origin (0, 0) over a chunk boundary
+			c = c->neighbors[NPOS(dx, dy)];
+			if (c == NULL) {
+				// evicted
+				c = get_chunk_by_pos(game, x, y, true);
+			}
+		} else {
+			// hash table lookup, we moved *over* a chunk
+			// is is super rare
+			c = get_chunk_by_pos(game, x, y, true);
+		}
+	}
+
+	render_chunks(c, end_x - x + 1, end_y - y + 1);
+	flush_fields();
+
+	return c;
+}
 
-		render_chunk(c);
+// whether the next frame differs from the last one, apart from the overlay
+static bool frame_changed() {
+	return game->dirty || game->dirty_rects_count > 0 || game->view_x != frame_view_x ||
+		   game->view_y != frame_view_y || w != frame_w || h != frame_h;
+}
 
-		SDL_RenderPresent(renderer);
+// Runs the work that can wait for a frame with time left. That is a frame that took less than half
+// of the frame budget to render, before the next refresh of the display the next one most likely
+// takes about as long, or no frame at all when the game is idle (render_ticks is 0).
+static void run_deferred_work(const uint64_t render_ticks) {
+	if (!evict_pending) {
+		return;
+	}
 
-		game->dirty = 0;
+	if (render_ticks > frame_budget / 2 && ++deferred_frames < DEFER_FRAMES_MAX) {
+		return;
 	}
+
+	TRACE_BEGIN(trace_start);
+
+	evict_old_chunks(game);
+	evict_pending = false;
+	deferred_frames = 0;
+
+	TRACE_END(trace_start, "evict_old_chunks", "chunks", game->chunks_count, "cold",
+			  game->cold_count);
+}
+
+static void render() {
+	static struct chunk *c = NULL;
+	SDL_Texture *target;
+	uint64_t start, present, end;
+	bool hud_changed;
+
+	// the size of the recording while replaying
+	get_window_size(window, &w, &h);
+
+	// every field looks different after losing
+	if (game->dead != chunk_textures_dead) {
+		free_chunk_textures();
+		chunk_textures_dead = game->dead;
+		game->dirty = 1;
+	}
+
+	// the overlay changes without the game
+	hud_changed = update_hud();
+
+	if (!frame_changed() && !hud_changed) {
+		return;
+	}
+
+	start = SDL_GetPerformanceCounter();
+	frame++;
+
+	TRACE_BEGIN(trace_start);
+
+	update_lod(game);
+	prefetch_view();
+	target = begin_frame();
+
+	if (game->zoom_out > 0) {
+		SDL_SetRenderDrawColor(renderer, LOD_COVERED_GREY, LOD_COVERED_GREY, LOD_COVERED_GREY, 255);
+		SDL_RenderFillRects(renderer, areas, areas_count);
+		render_summaries();
+		// the chunk may be evicted until the view zooms in again
+		c = NULL;
+	} else {
+		c = render_fields(c);
+	}
+
+	if (target != NULL) {
+		SDL_SetRenderTarget(renderer, NULL);
+		SDL_RenderCopy(renderer, target, NULL, NULL);
+	}
+
+	// on top of the frame, it is not kept in the frame textures
+	if (show_minimap) {
+		render_minimap();
+	}
+	render_hud();
+
+	present = SDL_GetPerformanceCounter();
+	SDL_RenderPresent(renderer);
+	end = SDL_GetPerformanceCounter();
+#ifndef NO_STATS
+	count_frame(start, present, end);
+#endif
+
+	frames_time += end - start;
+	frames++;
+
+	// the chunks in the window are the most recently used ones, c is one of them
+	evict_pending |= next_tick(game);
+	run_deferred_work(present - start);
+
+	TRACE_END(trace_start, "render", "frame", frame, "areas", areas_count);
 }
 
 static void main_loop() {
@@ -236,76 +1292,147 @@ static void main_loop() {
 	struct chunk *c;
 	SDL_Event event;
 	uint32_t cx, cy, fx, fy;
-	int prev_square_size, new_square_size;
+	// Mouse motion and wheel events come many per frame. The pan and zoom they add up to are
+	// applied once, before the next other event and after the last one.
+	int64_t pan_x = 0, pan_y = 0;
+	int zoom = 0;
+#ifndef NO_STATS
+	uint64_t start;
+
+	start = SDL_GetPerformanceCounter();
+#endif
+	TRACE_BEGIN(trace_start);
+
+	// recorded or replayed (see replay.c)
+	while (poll_event(&event)) {
+		if (event.type != SDL_MOUSEMOTION && (pan_x != 0 || pan_y != 0)) {
+			game->view_x += pan_x;
+			game->view_y += pan_y;
+			pan_x = pan_y = 0;
+		}
+		if (event.type != SDL_MOUSEWHEEL && zoom != 0) {
+			zoom_view(mouseX, mouseY, zoom);
+			zoom = 0;
+		}
 
-	while (SDL_PollEvent(&event)) {
 		if (event.type == SDL_QUIT) {
 			run = 0;
 			break;
 		} else if (event.type == SDL_WINDOWEVENT) {
 			game->dirty = 1;
+		} else if (event.type == SDL_RENDER_TARGETS_RESET ||
+				   event.type == SDL_RENDER_DEVICE_RESET) {
+			// the content of the chunk textures is lost
+			free_chunk_textures();
+			game->dirty = 1;
 		} else if (event.type == SDL_MOUSEBUTTONUP) {
-			if (event.button.button == SDL_BUTTON_LEFT) {
-				if (moving) {
+			// zoomed out fields are too small to be clicked
+			if (in_minimap(event.button.x, event.button.y)) {
+				if (event.button.button == SDL_BUTTON_LEFT && !moving) {
+					center_minimap(event.button.x, event.button.y);
+				}
+				moving = false;
+			} else if (event.button.button == SDL_BUTTON_LEFT) {
+				if (moving || game->zoom_out > 0) {
 					moving = false;
 				} else {
 					screen_to_game(event.button.x, event.button.y, &cx, &cy, &fx, &fy);
-					c = get_chunk_by_pos(cx, cy, true);
-					if (ISSET(FIELD_FLAG, c->fields[POS(fx, fy)])) {
-						field_toggle_flag(c, fx, fy);
+					c = get_chunk_by_pos(game, cx, cy, true);
+					if (c->fields != NULL && ISSET(FIELD_FLAG, c->fields[POS(fx, fy)])) {
+						field_toggle_flag(game, c, fx, fy);
 					} else {
-						uncover_field_inbounds(c, fx, fy);
+						uncover_field_inbounds(game, c, fx, fy);
 					}
-					game->dirty = 1;
 				}
-			} else if (event.button.button == SDL_BUTTON_RIGHT) {
+			} else if (event.button.button == SDL_BUTTON_RIGHT && game->zoom_out == 0) {
 				screen_to_game(event.button.x, event.button.y, &cx, &cy, &fx, &fy);
-				field_toggle_flag(get_chunk_by_pos(cx, cy, true), fx, fy);
-				game->dirty = 1;
+				field_toggle_flag(game, get_chunk_by_pos(game, cx, cy, true), fx, fy);
 			}
 		} else if (event.type == SDL_MOUSEMOTION) {
 			if (ISSET(SDL_BUTTON_LMASK, event.motion.state)) {
 				moving = true;
-				game->view_x += event.motion.xrel;
-				game->view_y += event.motion.yrel;
-				game->dirty = 1;
+				pan_x += event.motion.xrel;
+				pan_y += event.motion.yrel;
 			}
+			// the zoom was applied at the previous position
 			mouseX = event.motion.x;
 			mouseY = event.motion.y;
-		} else if (event.type == SDL_MOUSEWHEEL) {
-			prev_square_size = game->square_size;
-
-			new_square_size =
-				prev_square_size + event.wheel.y * SQUARE_SIZE_STEP *
-									   (event.wheel.direction == SDL_MOUSEWHEEL_FLIPPED ? -1 : 1);
-			if (new_square_size > SQUARE_SIZE_MAX) {
-				new_square_size = SQUARE_SIZE_MAX;
-			} else if (new_square_size < SQUARE_SIZE_MIN) {
-				new_square_size = SQUARE_SIZE_MIN;
-			}
-
-			game->view_x = mouseX - int_div_round_down(new_square_size * (mouseX - game->view_x),
-													   prev_square_size);
-			game->view_y = mouseY - int_div_round_down(new_square_size * (mouseY - game->view_y),
-													   prev_square_size);
-
-			texture_dstrect.w = texture_dstrect.h = new_square_size;
-			game->square_size = new_square_size;
+		} else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_m) {
+			show_minimap = !show_minimap;
+			game->dirty = 1;
+#ifndef NO_STATS
+		} else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_p) {
+			toggle_hud();
 			game->dirty = 1;
+#endif
+		} else if (event.type == SDL_MOUSEWHEEL) {
+			zoom += event.wheel.y * (event.wheel.direction == SDL_MOUSEWHEEL_FLIPPED ? -1 : 1);
 		}
 	}
 
+	game->view_x += pan_x;
+	game->view_y += pan_y;
+	if (zoom != 0) {
+		zoom_view(mouseX, mouseY, zoom);
+	}
+
+#ifndef NO_STATS
+	event_ticks += SDL_GetPerformanceCounter() - start;
+#endif
+
 	render();
 
+	TRACE_END(trace_start, "main_loop", NULL, 0, NULL, 0);
+
 #ifdef __EMSCRIPTEN__
 	if (!run) {
 		emscripten_cancel_main_loop();
-		cleanup();
+		finish_replay(game);
+		if (!replaying()) {
+			save_game(game, SAVE_FILE);
+		}
+		cleanup_renderer();
+		cleanup(game);
+	}
+#endif
+}
+
+#ifndef __EMSCRIPTEN__
+// Blocks until the next event while there is nothing to draw, so an idle game does not use the
+// CPU, and runs the deferred work first. The overlay is drawn again every HUD_INTERVAL_MS.
+// Replays deliver their events themselves.
+static void wait_for_event() {
+	int timeout;
+
+	if (replaying() || frame_changed()) {
+		return;
+	}
+
+	run_deferred_work(0);
+
+	timeout = IDLE_TIMEOUT_MS;
+#ifndef NO_STATS
+	if (show_hud) {
+		timeout = HUD_INTERVAL_MS - (int)(SDL_GetTicks() - hud_time);
+		if (timeout <= 0) {
+			return;
+		}
 	}
 #endif
+
+	// the event stays in the queue for main_loop
+	SDL_WaitEventTimeout(NULL, timeout);
 }
+#endif
+
+// Runs window_game until the window is closed, returns 1 if it could not start or a replay did not
+// match its recording
+int start_renderer(struct game *window_game) {
+	int err = 1;
+
+	game = window_game;
+	game->visibility = in_window;
 
-void start_renderer() {
 	if (init_sdl()) {
 		goto error;
 	}
@@ -316,16 +1443,28 @@ void start_renderer() {
 
 	run = 1;
 
+	trace_thread_name("main");
+	start_prefetch(game);
+
 #ifdef __EMSCRIPTEN__
 	emscripten_set_main_loop(main_loop, -1, 1);
-	return;
+	return 0;
 #else
+	// frames are paced by presenting them in sync with the display
 	while (run) {
+		wait_for_event();
 		main_loop();
-		SDL_Delay(10);
+	}
+
+	err = finish_replay(game);
+	// a replay must not overwrite the saved game
+	if (!replaying()) {
+		save_game(game, SAVE_FILE);
 	}
 #endif
 
 error:
-	cleanup();
+	cleanup_renderer();
+	cleanup(game);
+	return err;
 }
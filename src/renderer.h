@@ -13,8 +13,43 @@
 #define SQUARE_SIZE_MAX 64
 #define TEXTURE_SIZE 16
 #define TEXTURES 14
+// number of cached chunk images, each one is CHUNK_SIZE * TEXTURE_SIZE pixels square (4 MiB)
+#define CHUNK_TEXTURES 32
 #define TEXTURES_FILE "assets/minesweeper.png"
 
+// zoomed out chunks that are loaded are drawn as a tile of their blocks up to this zoom_out,
+// further out and for chunks that are not loaded the pyramid is used (see lod.c)
+#define LOD_TILE_ZOOM_OUT_MAX 4
+// nodes of the pyramid that are drawn are at least this many pixels wide
+#define LOD_NODE_SIZE_MIN 8
+// grey of covered and uncovered fields zoomed out, fields are red when one in LOD_FLAG_FIELDS of
+// them is flagged
+#define LOD_COVERED_GREY 96
+#define LOD_UNCOVERED_GREY 208
+#define LOD_FLAG_FIELDS 16
+
+// the minimap in the top right corner shows MINIMAP_CELLS * MINIMAP_CELLS nodes of the pyramid,
+// MINIMAP_LEVELS levels above the ones the window is drawn from
+#define MINIMAP_CELLS 32
+#define MINIMAP_CELL_SIZE 4
+#define MINIMAP_MARGIN 8
+#define MINIMAP_LEVELS 3
+
+// the performance overlay in the top left corner, toggled with P, shows HUD_LINES lines made from
+// the counters of the last HUD_INTERVAL_MS, in a 3x5 pixel font scaled up HUD_PIXEL_SIZE times
+#define HUD_INTERVAL_MS 500
+#define HUD_LINES 15
+#define HUD_LINE_LENGTH 32
+#define HUD_PIXEL_SIZE 2
+#define HUD_MARGIN 8
+
+// while nothing has to be drawn the game waits up to IDLE_TIMEOUT_MS for an event
+#define IDLE_TIMEOUT_MS 1000
+// frames are presented in sync with the display, this is assumed when it has no refresh rate
+#define DEFAULT_REFRESH_RATE 60
+// work that can wait for a frame with time left waits at most this many frames
+#define DEFER_FRAMES_MAX 30
+
 // 0 has no number, it has no surrounding mines
 // 1-8 are the numbers 1-8
 #define TEXTURE_MINE 9
@@ -23,10 +58,6 @@
 #define TEXTURE_FLAG 12
 #define TEXTURE_FLAG_WRONG 13
 
-void cleanup_renderer();
-
-int is_visible(struct chunk *c);
-
-void start_renderer();
+int start_renderer(struct game *window_game);
 
 #endif
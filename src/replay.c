@@ -0,0 +1,499 @@
+#include "replay.h"
+
+#include "game.h"
+#include "save.h"
+#include "util.h"
+
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The events of a recording are kept in memory and written when it ends, so recording does no I/O
+// while the game is played. A replay reads the whole file first for the same reason.
+
+// event of a replay, the values are in the order of enum replay_type
+struct replay_event {
+	uint32_t loop, time;
+	uint8_t type;
+	int64_t values[5];
+	uint64_t checksum;
+};
+
+static enum { REPLAY_OFF, REPLAY_RECORDING, REPLAY_PLAYING } mode = REPLAY_OFF;
+static const char *replay_path;
+static bool timed, headless;
+
+// the recorded events, or the events of the replay file, the next one is read from pos
+static uint8_t *buffer = NULL;
+static size_t buffer_size = 0, buffer_capacity = 0, pos = 0;
+
+// main_loop iteration, it is counted when the first event of the next one is polled so the window
+// size that render reads belongs to the iteration of its events
+static uint32_t loop = 0;
+static bool loop_done = false;
+// loop and time of the last recorded event, the time is in milliseconds since the first poll
+static uint32_t last_loop = 0, last_time = 0, start_time = 0;
+static bool started = false;
+// window size of the recording, or of the replay after its REPLAY_SIZE events, and the size the
+// window of the replay was set to
+static int window_w = 0, window_h = 0, resized_w = 0, resized_h = 0;
+
+// the next event of the replay, ended is set when there is none or it is REPLAY_END
+static struct replay_event next;
+static bool ended = false, stopped = false;
+static uint32_t events_count = 0;
+
+static void put_byte(const uint8_t byte) {
+	uint8_t *new_buffer;
+	size_t capacity;
+
+	if (buffer_size >= buffer_capacity) {
+		capacity = buffer_capacity ? buffer_capacity * 2 : REPLAY_BUFFER_SIZE;
+		new_buffer = realloc(buffer, capacity);
+
+		if (new_buffer == NULL) {
+			handle_alloc_error();
+		}
+
+		buffer = new_buffer;
+		buffer_capacity = capacity;
+	}
+
+	buffer[buffer_size++] = byte;
+}
+
+static void put_varint(uint64_t value) {
+	while (value >= 0x80) {
+		put_byte(value | 0x80);
+		value >>= 7;
+	}
+	put_byte(value);
+}
+
+static void put_signed(const int64_t value) {
+	put_varint((uint64_t)value << 1 ^ (uint64_t)(value >> 63));
+}
+
+static bool get_varint(uint64_t *value) {
+	uint32_t shift;
+
+	*value = 0;
+	for (shift = 0; pos < buffer_size && shift < 64; shift += 7) {
+		*value |= (uint64_t)(buffer[pos] & 0x7f) << shift;
+		if (!(buffer[pos++] & 0x80)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool get_signed(int64_t *value) {
+	uint64_t v;
+
+	if (!get_varint(&v)) {
+		return false;
+	}
+
+	*value = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+	return true;
+}
+
+static uint32_t replay_time() {
+	return SDL_GetTicks() - start_time;
+}
+
+static void record(const enum replay_type type, const uint32_t count, const int64_t *values) {
+	uint32_t i, time;
+
+	time = replay_time();
+
+	put_varint(loop - last_loop);
+	put_varint(time - last_time);
+	put_byte(type);
+	for (i = 0; i < count; i++) {
+		put_signed(values[i]);
+	}
+
+	last_loop = loop;
+	last_time = time;
+	events_count++;
+}
+
+// records event if main_loop handles its type
+static void record_event(const SDL_Event *event) {
+	int64_t values[5];
+
+	switch (event->type) {
+	case SDL_QUIT:
+		record(REPLAY_QUIT, 0, values);
+		break;
+	case SDL_WINDOWEVENT:
+		record(REPLAY_WINDOW, 0, values);
+		break;
+	case SDL_RENDER_TARGETS_RESET:
+	case SDL_RENDER_DEVICE_RESET:
+		record(REPLAY_RESET, 0, values);
+		break;
+	case SDL_MOUSEBUTTONUP:
+		values[0] = event->button.button;
+		values[1] = event->button.x;
+		values[2] = event->button.y;
+		record(REPLAY_BUTTON, 3, values);
+		break;
+	case SDL_MOUSEMOTION:
+		values[0] = ISSET(SDL_BUTTON_LMASK, event->motion.state) != 0;
+		values[1] = event->motion.x;
+		values[2] = event->motion.y;
+		values[3] = event->motion.xrel;
+		values[4] = event->motion.yrel;
+		record(REPLAY_MOTION, 5, values);
+		break;
+	case SDL_KEYDOWN:
+		values[0] = event->key.keysym.sym;
+		record(REPLAY_KEY, 1, values);
+		break;
+	case SDL_MOUSEWHEEL:
+		values[0] = event->wheel.y;
+		values[1] = event->wheel.direction == SDL_MOUSEWHEEL_FLIPPED;
+		record(REPLAY_WHEEL, 2, values);
+		break;
+	}
+}
+
+// number of values of an event of type
+static uint32_t replay_values(const uint8_t type) {
+	switch (type) {
+	case REPLAY_SIZE:
+	case REPLAY_WHEEL:
+		return 2;
+	case REPLAY_BUTTON:
+		return 3;
+	case REPLAY_MOTION:
+		return 5;
+	case REPLAY_KEY:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// reads the next event of the replay, a broken file ends the replay
+static void read_next() {
+	uint64_t loop_delta, time_delta;
+	uint32_t i;
+
+	if (ended) {
+		return;
+	}
+
+	if (pos == buffer_size) {
+		printf("Replay %s has no end, it was not closed properly\n", replay_path);
+		ended = true;
+		return;
+	}
+
+	if (!get_varint(&loop_delta) || !get_varint(&time_delta) || pos == buffer_size ||
+		buffer[pos] > REPLAY_END) {
+		printf("Replay %s is broken after %u events\n", replay_path, events_count);
+		ended = true;
+		return;
+	}
+
+	next.loop += loop_delta;
+	next.time += time_delta;
+	next.type = buffer[pos++];
+
+	for (i = 0; i < replay_values(next.type); i++) {
+		if (!get_signed(&next.values[i])) {
+			printf("Replay %s is broken after %u events\n", replay_path, events_count);
+			ended = true;
+			return;
+		}
+	}
+
+	if (next.type == REPLAY_END) {
+		if (!get_varint(&next.checksum)) {
+			printf("Replay %s is broken after %u events\n", replay_path, events_count);
+		}
+		ended = true;
+	}
+}
+
+// Records the events of the game to path, the file is written by finish_replay. The game has to be
+// a new one, a replay starts from the seed alone.
+int start_recording(const char *path) {
+	mode = REPLAY_RECORDING;
+	replay_path = path;
+
+	return 0;
+}
+
+// Reads the replay file at path and returns the seed of its game, the events are fed to main_loop
+// by poll_event. timed keeps the time between the events, headless hides the window.
+int load_replay(const char *path, const bool replay_timed, const bool replay_headless,
+				uint32_t *seed) {
+	struct replay_header h;
+	FILE *f;
+	long size;
+
+	f = fopen(path, "rb");
+
+	if (f == NULL) {
+		printf("Could not open replay %s\n", path);
+		return 1;
+	}
+
+	if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, REPLAY_MAGIC, sizeof(h.magic)) != 0 ||
+		h.version != REPLAY_VERSION || fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 ||
+		fseek(f, sizeof(h), SEEK_SET) != 0) {
+		printf("Replay %s is invalid, or it is from another version\n", path);
+		fclose(f);
+		return 1;
+	}
+
+	buffer_size = buffer_capacity = size - sizeof(h);
+	buffer = malloc(buffer_size + 1);
+
+	if (buffer == NULL) {
+		handle_alloc_error();
+	}
+
+	if (fread(buffer, 1, buffer_size, f) != buffer_size) {
+		printf("Could not read replay %s\n", path);
+		fclose(f);
+		return 1;
+	}
+
+	fclose(f);
+
+	mode = REPLAY_PLAYING;
+	replay_path = path;
+	timed = replay_timed;
+	headless = replay_headless;
+	*seed = h.seed;
+
+	read_next();
+
+	return 0;
+}
+
+bool replaying() {
+	return mode == REPLAY_PLAYING;
+}
+
+bool replay_headless() {
+	return mode == REPLAY_PLAYING && headless;
+}
+
+// whether main_loop runs without waiting between iterations
+bool replay_fast() {
+	return mode == REPLAY_PLAYING && !timed;
+}
+
+// turns the next event of the replay into event
+static void replay_event(SDL_Event *event) {
+	memset(event, 0, sizeof(*event));
+
+	switch (next.type) {
+	case REPLAY_QUIT:
+		event->type = SDL_QUIT;
+		break;
+	case REPLAY_WINDOW:
+		event->type = SDL_WINDOWEVENT;
+		event->window.event = SDL_WINDOWEVENT_EXPOSED;
+		break;
+	case REPLAY_RESET:
+		event->type = SDL_RENDER_TARGETS_RESET;
+		break;
+	case REPLAY_BUTTON:
+		event->type = SDL_MOUSEBUTTONUP;
+		event->button.button = next.values[0];
+		event->button.x = next.values[1];
+		event->button.y = next.values[2];
+		break;
+	case REPLAY_MOTION:
+		event->type = SDL_MOUSEMOTION;
+		event->motion.state = next.values[0] ? SDL_BUTTON_LMASK : 0;
+		event->motion.x = next.values[1];
+		event->motion.y = next.values[2];
+		event->motion.xrel = next.values[3];
+		event->motion.yrel = next.values[4];
+		break;
+	case REPLAY_KEY:
+		event->type = SDL_KEYDOWN;
+		event->key.keysym.sym = next.values[0];
+		break;
+	case REPLAY_WHEEL:
+		event->type = SDL_MOUSEWHEEL;
+		event->wheel.y = next.values[0];
+		event->wheel.direction = next.values[1] ? SDL_MOUSEWHEEL_FLIPPED : SDL_MOUSEWHEEL_NORMAL;
+		break;
+	}
+}
+
+// Replaces SDL_PollEvent in main_loop. While recording the events are recorded, while replaying
+// the events of the replay are returned instead, in the same main_loop iterations as they were
+// recorded, and only closing the window is taken from SDL. The end of the replay quits the game.
+bool poll_event(SDL_Event *event) {
+	SDL_Event sdl_event;
+	uint32_t time;
+
+	if (!started) {
+		start_time = SDL_GetTicks();
+		started = true;
+	}
+
+	if (loop_done) {
+		loop++;
+		loop_done = false;
+	}
+
+	if (mode != REPLAY_PLAYING) {
+		if (SDL_PollEvent(event)) {
+			if (mode == REPLAY_RECORDING) {
+				record_event(event);
+			}
+			return true;
+		}
+
+		loop_done = true;
+		return false;
+	}
+
+	while (SDL_PollEvent(&sdl_event)) {
+		if (sdl_event.type == SDL_QUIT) {
+			stopped = true;
+			*event = sdl_event;
+			return true;
+		}
+	}
+
+	while (!ended && next.loop == loop) {
+		if (timed) {
+			time = replay_time();
+			if (time < next.time) {
+				SDL_Delay(next.time - time);
+			}
+		}
+
+		events_count++;
+
+		// the size is read by render
+		if (next.type == REPLAY_SIZE) {
+			window_w = next.values[0];
+			window_h = next.values[1];
+			read_next();
+			continue;
+		}
+
+		replay_event(event);
+		read_next();
+		return true;
+	}
+
+	if (ended && next.loop <= loop) {
+		event->type = SDL_QUIT;
+		return true;
+	}
+
+	loop_done = true;
+	return false;
+}
+
+// The size of the window for render. While recording changes of it are recorded, while replaying
+// the recorded size is used and the window is resized to it.
+void get_window_size(SDL_Window *window, int *w, int *h) {
+	int64_t values[2];
+
+	if (mode != REPLAY_PLAYING) {
+		SDL_GetWindowSize(window, w, h);
+
+		if (mode == REPLAY_RECORDING && (*w != window_w || *h != window_h)) {
+			window_w = values[0] = *w;
+			window_h = values[1] = *h;
+			record(REPLAY_SIZE, 2, values);
+		}
+		return;
+	}
+
+	if (window_w != resized_w || window_h != resized_h) {
+		SDL_SetWindowSize(window, window_w, window_h);
+		resized_w = window_w;
+		resized_h = window_h;
+	}
+
+	*w = window_w;
+	*h = window_h;
+}
+
+// Ends a recording by writing it with the world checksum, or checks the world checksum at the end
+// of a replay. Returns 1 if the file could not be written or the replay did not match.
+int finish_replay(struct game *game) {
+	struct replay_header h;
+	uint64_t checksum;
+	FILE *f;
+	int err;
+
+	if (mode == REPLAY_OFF) {
+		return 0;
+	}
+
+	checksum = world_checksum(game);
+
+	if (mode == REPLAY_PLAYING) {
+		free(buffer);
+		buffer = NULL;
+
+		if (stopped || next.type != REPLAY_END) {
+			printf("Replay %s stopped after %u of its events, world checksum %016llx\n",
+				   replay_path, events_count, (unsigned long long)checksum);
+			return 1;
+		}
+
+		if (checksum != next.checksum) {
+			printf("Replay %s did not match the recording after %u iterations, world checksum "
+				   "%016llx, recorded %016llx\n",
+				   replay_path, loop, (unsigned long long)checksum,
+				   (unsigned long long)next.checksum);
+			return 1;
+		}
+
+		printf("Replay %s matched the recording after %u iterations in %.3f s, world checksum "
+			   "%016llx\n",
+			   replay_path, loop, replay_time() / 1000.0, (unsigned long long)checksum);
+		return 0;
+	}
+
+	put_varint(loop - last_loop);
+	put_varint(replay_time() - last_time);
+	put_byte(REPLAY_END);
+	put_varint(checksum);
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, REPLAY_MAGIC, sizeof(h.magic));
+	h.version = REPLAY_VERSION;
+	h.seed = game->seed;
+
+	f = fopen(replay_path, "wb");
+	err = f == NULL || fwrite(&h, sizeof(h), 1, f) != 1 ||
+		  fwrite(buffer, 1, buffer_size, f) != buffer_size;
+	if (f != NULL) {
+		err |= fclose(f) != 0;
+	}
+
+	free(buffer);
+	buffer = NULL;
+
+	if (err) {
+		printf("Failed to write replay %s\n", replay_path);
+		return 1;
+	}
+
+	printf("Recorded %u events in %u iterations to %s, world checksum %016llx\n", events_count,
+		   loop, replay_path, (unsigned long long)checksum);
+	return 0;
+}
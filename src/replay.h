@@ -0,0 +1,59 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define REPLAY_MAGIC "IMSWREPL"
+// increment when the layout below changes, older recordings can not be replayed then
+#define REPLAY_VERSION 3
+#define REPLAY_BUFFER_SIZE 4096
+
+// A replay file is a replay_header and the events main_loop consumed. An event is the number of
+// main_loop iterations and of milliseconds since the previous event as varints, a REPLAY_* type
+// byte and the values of the type as varints, signed ones zigzag encoded. The recording ends with
+// REPLAY_END and the world checksum (see world_checksum). All values of the header are in the byte
+// order of the machine, like the save file.
+struct replay_header {
+	char magic[8];
+	uint32_t version, seed;
+};
+
+enum replay_type {
+	REPLAY_QUIT,
+	// any window event, the size of the window is recorded separately by REPLAY_SIZE (w, h)
+	REPLAY_WINDOW,
+	REPLAY_SIZE,
+	REPLAY_RESET,
+	// released mouse button (button, x, y)
+	REPLAY_BUTTON,
+	// mouse motion (left button held, x, y, xrel, yrel)
+	REPLAY_MOTION,
+	// pressed key (sym)
+	REPLAY_KEY,
+	// mouse wheel (y, flipped)
+	REPLAY_WHEEL,
+	REPLAY_END,
+};
+
+union SDL_Event;
+struct SDL_Window;
+struct game;
+
+int start_recording(const char *path);
+
+int load_replay(const char *path, const bool timed, const bool headless, uint32_t *seed);
+
+bool replaying();
+
+bool replay_headless();
+
+bool replay_fast();
+
+bool poll_event(union SDL_Event *event);
+
+void get_window_size(struct SDL_Window *window, int *w, int *h);
+
+int finish_replay(struct game *game);
+
+#endif
@@ -0,0 +1,456 @@
+#include "save.h"
+
+#include "chunk.h"
+#include "evict.h"
+#include "game.h"
+#include "lod.h"
+#include "renderer.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// chunk that is written to a save file, from the game, evicted or from the previous save file
+struct save_entry {
+	uint32_t x, y;
+	struct chunk *c;
+	const struct cold_slot *cold;
+	const struct save_chunk *saved;
+};
+
+static const struct save_index *save_index(const struct save_header *h) {
+	return (const struct save_index *)(h + 1);
+}
+
+static const struct save_chunk *save_chunks(const struct save_header *h) {
+	return (const struct save_chunk *)(save_index(h) + h->chunks_count);
+}
+
+static uint64_t save_key(const uint32_t x, const uint32_t y) {
+	return (uint64_t)x << 32 | y;
+}
+
+static uint64_t save_file_size(const uint32_t chunks_count) {
+	return sizeof(struct save_header) +
+		   (uint64_t)chunks_count * (sizeof(struct save_index) + sizeof(struct save_chunk));
+}
+
+// binary search in the sorted index, only the pages of the index that are visited are read
+const struct save_chunk *find_saved_chunk(struct game *game, const uint32_t x, const uint32_t y) {
+	const struct save_index *index;
+	uint32_t low, high, mid;
+	uint64_t key, mid_key;
+
+	if (game->save == NULL) {
+		return NULL;
+	}
+
+	index = save_index(game->save);
+	key = save_key(x, y);
+	low = 0;
+	high = game->save->chunks_count;
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		mid_key = save_key(index[mid].x, index[mid].y);
+		if (mid_key == key) {
+			return &save_chunks(game->save)[mid];
+		} else if (mid_key < key) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return NULL;
+}
+
+// Sets the uncovered and flag bits and the frontier of a new chunk from the save file, returns
+// whether it is in there
+bool restore_chunk(struct game *game, struct chunk *c) {
+	const struct save_chunk *saved;
+	uint32_t x, y;
+
+	saved = find_saved_chunk(game, c->x, c->y);
+
+	if (saved == NULL) {
+		return false;
+	}
+
+	for (y = 0; y < CHUNK_SIZE; y++) {
+		// a chunk that only has a frontier stays without fields
+		if ((saved->uncovered[y] | saved->flags[y]) == 0) {
+			continue;
+		}
+
+		expand_chunk(game, c);
+		for (x = 0; x < CHUNK_SIZE; x++) {
+			if (saved->uncovered[y] >> x & 1) {
+				SET(FIELD_UNCOVERED, c->fields[POS(x, y)]);
+			}
+			if (saved->flags[y] >> x & 1) {
+				SET(FIELD_FLAG, c->fields[POS(x, y)]);
+			}
+		}
+	}
+
+	if (saved->hit) {
+		SET(CHUNK_HIT, c->flags);
+		memcpy(c->frontier, saved->frontier, sizeof(c->frontier));
+		memcpy(c->uncounted, saved->uncounted, sizeof(c->uncounted));
+	}
+
+	return true;
+}
+
+// Loads the chunks in the window at the saved view, chunks further away are loaded by
+// get_chunk_by_pos when they are first needed
+static void preload_chunks(struct game *game) {
+	const int64_t chunk_pixels = (int64_t)game->square_size * CHUNK_SIZE;
+	uint32_t cx, cy, x, y, w, h;
+
+	cx = int_div_round_down(-game->view_x, chunk_pixels);
+	cy = int_div_round_down(-game->view_y, chunk_pixels);
+	w = WINDOW_WIDTH / chunk_pixels + 2;
+	h = WINDOW_HEIGHT / chunk_pixels + 2;
+
+	for (y = 0; y < h; y++) {
+		for (x = 0; x < w; x++) {
+			get_chunk_by_pos(game, cx + x, cy + y, false);
+		}
+	}
+}
+
+// Starts the game saved in path, returns NULL if there is no valid save file there
+struct game *load_game(const char *path) {
+	const struct save_index *index;
+	struct game *game;
+	const struct save_header *h;
+	struct stat st;
+	uint32_t i;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+
+	if (fd == -1) {
+		return NULL;
+	}
+
+	if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct save_header)) {
+		printf("Ignoring invalid save file %s\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	h = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (h == MAP_FAILED) {
+		printf("Failed to map save file %s\n", path);
+		return NULL;
+	}
+
+	if (memcmp(h->magic, SAVE_MAGIC, sizeof(h->magic)) != 0 || h->version != SAVE_VERSION ||
+		save_file_size(h->chunks_count) != (uint64_t)st.st_size ||
+		h->square_size < SQUARE_SIZE_MIN || h->square_size > SQUARE_SIZE_MAX ||
+		h->zoom_out > LOD_ZOOM_OUT_MAX) {
+		printf("Ignoring invalid save file %s, or it is from another version\n", path);
+		munmap((void *)h, st.st_size);
+		return NULL;
+	}
+
+	game = init_game(h->seed);
+	game->mine_threshold = h->mine_threshold;
+	game->view_x = h->view_x;
+	game->view_y = h->view_y;
+	game->square_size = h->square_size;
+	game->zoom_out = h->zoom_out;
+	game->save = h;
+	game->save_size = st.st_size;
+
+	index = save_index(h);
+	for (i = 0; i < h->chunks_count; i++) {
+		add_summary(game, index[i].x, index[i].y, index[i].uncovered, index[i].flags);
+	}
+
+	// zoomed out no fields are shown
+	if (game->zoom_out == 0) {
+		preload_chunks(game);
+	}
+
+	return game;
+}
+
+void close_save(struct game *game) {
+	if (game->save != NULL) {
+		munmap((void *)game->save, game->save_size);
+		game->save = NULL;
+	}
+}
+
+// a chunk with uncovered or flagged fields, or a frontier of a fill that stopped at it
+static bool chunk_has_state(const struct chunk *c) {
+	uint32_t i;
+
+	if (ISSET(CHUNK_HIT, c->flags)) {
+		return true;
+	}
+
+	if (c->fields == NULL) {
+		return false;
+	}
+
+	for (i = 0; i < CHUNK_SIZE * CHUNK_SIZE; i++) {
+		if (ISSET(FIELD_UNCOVERED | FIELD_FLAG, c->fields[i])) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static int compare_entries(const void *a, const void *b) {
+	const uint64_t key_a = save_key(((const struct save_entry *)a)->x,
+									((const struct save_entry *)a)->y),
+				   key_b = save_key(((const struct save_entry *)b)->x,
+									((const struct save_entry *)b)->y);
+
+	return (key_a > key_b) - (key_a < key_b);
+}
+
+// Returns the uncovered and flagged fields and the frontier of entry, chunk is used for the ones
+// that are not in the save file already
+static const struct save_chunk *entry_chunk(const struct save_entry *entry,
+											struct save_chunk *chunk) {
+	uint32_t x, y;
+
+	if (entry->saved != NULL) {
+		return entry->saved;
+	}
+
+	memset(chunk, 0, sizeof(*chunk));
+
+	if (entry->cold != NULL) {
+		cold_chunk_planes(entry->cold, chunk->uncovered, chunk->flags);
+		if (entry->cold->frontier != NULL) {
+			chunk->hit = 1;
+			memcpy(chunk->frontier, entry->cold->frontier, sizeof(chunk->frontier));
+			memcpy(chunk->uncounted, entry->cold->frontier + 9, sizeof(chunk->uncounted));
+		}
+		return chunk;
+	}
+
+	if (ISSET(CHUNK_HIT, entry->c->flags)) {
+		chunk->hit = 1;
+		memcpy(chunk->frontier, entry->c->frontier, sizeof(chunk->frontier));
+		memcpy(chunk->uncounted, entry->c->uncounted, sizeof(chunk->uncounted));
+	}
+
+	for (y = 0; entry->c->fields != NULL && y < CHUNK_SIZE; y++) {
+		for (x = 0; x < CHUNK_SIZE; x++) {
+			if (ISSET(FIELD_UNCOVERED, entry->c->fields[POS(x, y)])) {
+				chunk->uncovered[y] |= (uint64_t)1 << x;
+			}
+			if (ISSET(FIELD_FLAG, entry->c->fields[POS(x, y)])) {
+				chunk->flags[y] |= (uint64_t)1 << x;
+			}
+		}
+	}
+
+	return chunk;
+}
+
+// Returns all chunks with uncovered or flagged fields or a frontier, from the game, evicted or from
+// the save file, sorted by x and then y. The caller frees the array.
+static struct save_entry *collect_entries(struct game *game, uint32_t *count_out) {
+	const struct save_index *index;
+	struct save_entry *entries;
+	uint32_t i, count;
+
+	count = 0;
+	entries = malloc(((size_t)game->chunks_count + game->cold_count +
+					  (game->save ? game->save->chunks_count : 0) + 1) *
+					 sizeof(struct save_entry));
+
+	if (entries == NULL) {
+		handle_alloc_error();
+	}
+
+	for (i = 0; i < game->chunks_size; i++) {
+		if (game->chunks[i].c != NULL && chunk_has_state(game->chunks[i].c)) {
+			entries[count].x = game->chunks[i].x;
+			entries[count].y = game->chunks[i].y;
+			entries[count].c = game->chunks[i].c;
+			entries[count].cold = NULL;
+			entries[count].saved = NULL;
+			count++;
+		}
+	}
+
+	for (i = 0; i < game->cold_size; i++) {
+		if (game->cold[i].runs != NULL) {
+			entries[count].x = game->cold[i].x;
+			entries[count].y = game->cold[i].y;
+			entries[count].c = NULL;
+			entries[count].cold = &game->cold[i];
+			entries[count].saved = NULL;
+			count++;
+		}
+	}
+
+	if (game->save != NULL) {
+		index = save_index(game->save);
+		for (i = 0; i < game->save->chunks_count; i++) {
+			if (find_chunk(game, index[i].x, index[i].y) == NULL &&
+				find_cold_chunk(game, index[i].x, index[i].y) == NULL) {
+				entries[count].x = index[i].x;
+				entries[count].y = index[i].y;
+				entries[count].c = NULL;
+				entries[count].cold = NULL;
+				entries[count].saved = &save_chunks(game->save)[i];
+				count++;
+			}
+		}
+	}
+
+	qsort(entries, count, sizeof(struct save_entry), compare_entries);
+
+	*count_out = count;
+	return entries;
+}
+
+static int write_entries(struct game *game, FILE *f, const struct save_entry *entries,
+						 const uint32_t count) {
+	const struct lod_node *node;
+	struct save_header h;
+	struct save_index index;
+	struct save_chunk chunk;
+	uint32_t i;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SAVE_MAGIC, sizeof(h.magic));
+	h.version = SAVE_VERSION;
+	h.seed = game->seed;
+	h.mine_threshold = game->mine_threshold;
+	h.chunks_count = count;
+	h.view_x = game->view_x;
+	h.view_y = game->view_y;
+	h.square_size = game->square_size;
+	h.zoom_out = game->zoom_out;
+
+	if (fwrite(&h, sizeof(h), 1, f) != 1) {
+		return 1;
+	}
+
+	// every chunk with state changed once, so the pyramid has its summary
+	update_lod(game);
+
+	for (i = 0; i < count; i++) {
+		node = find_lod_node(game, 0, entries[i].x, entries[i].y);
+		index.x = entries[i].x;
+		index.y = entries[i].y;
+		index.uncovered = node ? node->uncovered : 0;
+		index.flags = node ? node->flags : 0;
+		if (fwrite(&index, sizeof(index), 1, f) != 1) {
+			return 1;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (fwrite(entry_chunk(&entries[i], &chunk), sizeof(chunk), 1, f) != 1) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Writes the game to path, chunks without uncovered or flagged fields or a frontier are not
+// written. Saved chunks that were never loaded again are copied from the old save file, evicted
+// chunks are decoded. A lost game is not saved, the next start begins a new one.
+int save_game(struct game *game, const char *path) {
+	struct save_entry *entries;
+	char tmp_path[256];
+	uint32_t count;
+	FILE *f;
+	int err;
+
+	if (game->dead) {
+		remove(path);
+		return 0;
+	}
+
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+		printf("Save file path too long\n");
+		return 1;
+	}
+
+	entries = collect_entries(game, &count);
+
+	f = fopen(tmp_path, "wb");
+
+	if (f == NULL) {
+		printf("Failed to open %s for writing\n", tmp_path);
+		free(entries);
+		return 1;
+	}
+
+	err = write_entries(game, f, entries, count);
+	err |= fclose(f) != 0;
+	free(entries);
+
+	// the old file stays intact until the new one is complete, it may still be mapped
+	if (err || rename(tmp_path, path) != 0) {
+		printf("Failed to write save file %s\n", path);
+		remove(tmp_path);
+		return 1;
+	}
+
+	return 0;
+}
+
+// Hash of what a save file of the game would hold: the uncovered and flagged fields and the
+// frontier of every chunk, wherever it is kept, the view, the zoom and whether the game is lost.
+// It does not depend on the order the chunks were created in or on which of them were evicted.
+uint64_t world_checksum(struct game *game) {
+	const struct save_chunk *saved;
+	struct save_entry *entries;
+	struct save_chunk chunk;
+	uint32_t i, y, count;
+	uint64_t h;
+
+	entries = collect_entries(game, &count);
+
+	// FNV-1a over 64 bit words
+	h = 0xcbf29ce484222325;
+	for (i = 0; i < count; i++) {
+		saved = entry_chunk(&entries[i], &chunk);
+		h = (h ^ save_key(entries[i].x, entries[i].y)) * 0x100000001b3;
+		for (y = 0; y < CHUNK_SIZE; y++) {
+			h = (h ^ saved->uncovered[y]) * 0x100000001b3;
+			h = (h ^ saved->flags[y]) * 0x100000001b3;
+		}
+		for (y = 0; saved->hit && y < 9; y++) {
+			h = (h ^ saved->frontier[y]) * 0x100000001b3;
+		}
+		for (y = 0; saved->hit && y < 4; y++) {
+			h = (h ^ saved->uncounted[y]) * 0x100000001b3;
+		}
+	}
+
+	h = (h ^ (uint64_t)game->view_x) * 0x100000001b3;
+	h = (h ^ (uint64_t)game->view_y) * 0x100000001b3;
+	h = (h ^ (uint64_t)game->square_size) * 0x100000001b3;
+	h = (h ^ (uint64_t)game->zoom_out) * 0x100000001b3;
+	h = (h ^ game->dead) * 0x100000001b3;
+
+	free(entries);
+
+	return h;
+}
@@ -0,0 +1,53 @@
+#ifndef SAVE_H
+#define SAVE_H
+
+#include "chunk.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SAVE_FILE "minesweeper.save"
+#define SAVE_MAGIC "IMSWSAVE"
+// increment when the layout below changes, older files are then ignored
+#define SAVE_VERSION 3
+
+// A save file is a save_header, chunks_count save_index entries sorted by x and then y and
+// chunks_count save_chunk records in the same order. Only the state of the player is stored, mines
+// are generated again from the seed. All values are in the byte order of the machine.
+struct save_header {
+	char magic[8];
+	uint32_t version, seed, mine_threshold, chunks_count;
+	int64_t view_x, view_y;
+	int32_t square_size;
+	uint32_t zoom_out;
+};
+
+// the numbers of uncovered and flagged fields of the chunk seed the lod pyramid when the game is
+// loaded, without reading the chunks
+struct save_index {
+	uint32_t x, y, uncovered, flags;
+};
+
+// Bit x of row y is field (x, y). frontier and uncounted are the ones of the chunk if a fill
+// stopped at it (hit), so the fill continues when it becomes visible, otherwise they are 0.
+struct save_chunk {
+	uint64_t uncovered[CHUNK_SIZE];
+	uint64_t flags[CHUNK_SIZE];
+	uint64_t frontier[9], uncounted[4];
+	uint8_t hit;
+	uint8_t padding[7];
+};
+
+struct game *load_game(const char *path);
+
+int save_game(struct game *game, const char *path);
+
+uint64_t world_checksum(struct game *game);
+
+void close_save(struct game *game);
+
+bool restore_chunk(struct game *game, struct chunk *c);
+
+const struct save_chunk *find_saved_chunk(struct game *game, const uint32_t x, const uint32_t y);
+
+#endif
@@ -0,0 +1,972 @@
+#ifdef SERVER
+
+// accept4
+#define _GNU_SOURCE
+
+#include "chunk.h"
+#include "evict.h"
+#include "game.h"
+#include "lod.h"
+#include "pool.h"
+#include "protocol.h"
+#include "renderer.h"
+#include "trace.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Headless game server, every session is a game that clients play and watch over a Unix socket (see
+// protocol.h). The sessions are spread over the shard threads, a shard runs all requests of the
+// clients of its sessions from its own epoll, so a game is only used by one thread and needs no
+// lock. The acceptor, the main thread, reads the MSG_JOIN of a new client and hands the client to
+// the shard of its session.
+
+#define SERVER_SHARDS_MAX 64
+#define SERVER_EVENTS 256
+#define SERVER_TRACE_FILE "minesweeper_server.trace.json"
+// chunks of a session are evicted when they use more than this, a server holds many games
+#define SESSION_MEMORY_BUDGET (16 * 1024 * 1024)
+// bytes of a client's requests that are read at once, larger than any request
+#define CLIENT_IN_SIZE 256
+// a client that does not read its replies is dropped when this many bytes wait for it
+#define CLIENT_OUT_MAX (1024 * 1024)
+
+struct session {
+	uint32_t id, seed;
+	// clients that joined, the ones on their way to the shard included, the session is freed with
+	// the last one (under sessions_lock)
+	uint32_t refs;
+	struct shard *shard;
+	// started by the shard when the first client arrives, only used by the shard
+	struct game *game;
+	struct client *clients;
+};
+
+struct client {
+	int fd;
+	struct session *session;
+	// next client of the session, or in the inbox of the shard
+	struct client *next;
+	// chunks the client looks at (see session_sees)
+	uint32_t view_x, view_y, view_w, view_h;
+	// fields whose changes are sent as MSG_CHANGED, w is 0 without a subscription
+	struct proto_rect subscription;
+	// received bytes of requests that are not handled yet
+	uint8_t in[CLIENT_IN_SIZE];
+	uint32_t in_count;
+	// replies that did not fit in the socket yet, EPOLLOUT is watched while there are any
+	uint8_t *out;
+	uint32_t out_count, out_size;
+	bool watching_out;
+	// the connection was shut down, the client is closed on its next event (see drop_client)
+	bool dropped;
+};
+
+struct shard {
+	pthread_t thread;
+	int epoll, wakeup;
+	// clients handed over by the acceptor, wakeup is written for every one
+	pthread_mutex_t inbox_lock;
+	struct client *inbox;
+	uint64_t requests;
+};
+
+static struct shard shards[SERVER_SHARDS_MAX];
+static uint32_t shards_count;
+static atomic_bool stopping;
+
+// session id - 1 to the session, NULL when it ended
+static pthread_mutex_t sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct session **sessions;
+static uint32_t sessions_count, sessions_size;
+
+// A chunk is visible when a client of the session looks at it, the fills of the session spread
+// into it and continue there when it becomes visible, like the chunks inside the window
+static bool session_sees(const struct chunk *c, void *data) {
+	const struct session *s = data;
+	struct client *client;
+
+	for (client = s->clients; client != NULL; client = client->next) {
+		if (c->x - client->view_x < client->view_w && c->y - client->view_y < client->view_h) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Returns the session of join with a reference for the client, NULL if there is no such session
+static struct session *join_session(const struct proto_join *join) {
+	struct session *s, **new_sessions;
+	uint32_t size;
+
+	s = NULL;
+
+	pthread_mutex_lock(&sessions_lock);
+
+	if (join->session == 0) {
+		if (sessions_count >= sessions_size) {
+			size = sessions_size ? sessions_size * 2 : 1024;
+			new_sessions = realloc(sessions, sizeof(*sessions) * size);
+
+			if (new_sessions == NULL) {
+				handle_alloc_error();
+			}
+
+			sessions = new_sessions;
+			sessions_size = size;
+		}
+
+		s = calloc(1, sizeof(struct session));
+
+		if (s == NULL) {
+			handle_alloc_error();
+		}
+
+		s->id = ++sessions_count;
+		s->seed = join->seed;
+		s->shard = &shards[(s->id - 1) % shards_count];
+		sessions[s->id - 1] = s;
+	} else if (join->session <= sessions_count) {
+		s = sessions[join->session - 1];
+	}
+
+	if (s != NULL) {
+		s->refs++;
+	}
+
+	pthread_mutex_unlock(&sessions_lock);
+
+	return s;
+}
+
+// Drops the reference of a client, the last one ends the session and frees its game
+static void leave_session(struct session *s) {
+	bool last;
+
+	pthread_mutex_lock(&sessions_lock);
+	last = --s->refs == 0;
+	if (last) {
+		sessions[s->id - 1] = NULL;
+	}
+	pthread_mutex_unlock(&sessions_lock);
+
+	if (!last) {
+		return;
+	}
+
+	if (s->game != NULL) {
+		free_game(s->game);
+	}
+
+	free(s);
+}
+
+static uint32_t request_size(const uint8_t type) {
+	switch (type) {
+	case MSG_UNCOVER:
+	case MSG_FLAG:
+		return sizeof(struct proto_pos);
+	case MSG_REGION:
+	case MSG_SUBSCRIBE:
+		return sizeof(struct proto_rect);
+	default:
+		// MSG_JOIN is only the first message
+		return 0;
+	}
+}
+
+// Shuts the connection of client down, it is closed when its shard handles its next event, so
+// clients of a session can be dropped while the requests of another one are handled
+static void drop_client(struct client *client) {
+	if (client->dropped) {
+		return;
+	}
+
+	client->dropped = true;
+	client->out_count = 0;
+	shutdown(client->fd, SHUT_RDWR);
+}
+
+// Returns size bytes at the end of the replies of client, NULL if the client was dropped
+static uint8_t *reserve_out(struct client *client, const uint32_t size) {
+	uint8_t *new_out;
+	uint32_t new_size;
+
+	if (client->dropped) {
+		return NULL;
+	}
+
+	if (client->out_count + size > CLIENT_OUT_MAX) {
+		drop_client(client);
+		return NULL;
+	}
+
+	if (client->out_count + size > client->out_size) {
+		new_size = client->out_size ? client->out_size : 256;
+		while (new_size < client->out_count + size) {
+			new_size *= 2;
+		}
+
+		new_out = realloc(client->out, new_size);
+
+		if (new_out == NULL) {
+			handle_alloc_error();
+		}
+
+		client->out = new_out;
+		client->out_size = new_size;
+	}
+
+	client->out_count += size;
+
+	return client->out + client->out_count - size;
+}
+
+static void reply(struct client *client, const uint8_t type, const void *body,
+				  const uint32_t size) {
+	uint8_t *out;
+
+	out = reserve_out(client, 1 + size);
+
+	if (out != NULL) {
+		out[0] = type;
+		memcpy(out + 1, body, size);
+	}
+}
+
+static void reply_error(struct client *client, const uint8_t code) {
+	const struct proto_error error = {.code = code};
+
+	reply(client, MSG_ERROR, &error, sizeof(error));
+}
+
+// Sends as many replies as the socket takes, the rest is sent when it can take more (EPOLLOUT)
+static void flush_client(struct client *client) {
+	struct epoll_event event;
+	ssize_t n;
+	bool watch;
+
+	while (client->out_count > 0) {
+		n = send(client->fd, client->out, client->out_count, MSG_NOSIGNAL);
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		}
+		if (n < 0) {
+			drop_client(client);
+			return;
+		}
+
+		client->out_count -= n;
+		memmove(client->out, client->out + n, client->out_count);
+	}
+
+	watch = client->out_count > 0;
+
+	if (watch != client->watching_out) {
+		event.events = watch ? EPOLLIN | EPOLLOUT : EPOLLIN;
+		event.data.ptr = client;
+		epoll_ctl(client->session->shard->epoll, EPOLL_CTL_MOD, client->fd, &event);
+		client->watching_out = watch;
+	}
+}
+
+static void flush_session(struct session *s) {
+	struct client *client;
+
+	for (client = s->clients; client != NULL; client = client->next) {
+		if (client->out_count > 0) {
+			flush_client(client);
+		}
+	}
+}
+
+// Returns the state of field x, y of c (see FIELD_STATE_COVERED) the way the renderer draws it, c
+// is NULL for a chunk that was not created
+static uint8_t field_state(struct game *game, struct chunk *c, const uint32_t x, const uint32_t y) {
+	uint8_t field;
+	int mines;
+
+	field = c != NULL && c->fields != NULL ? c->fields[POS(x, y)] : 0;
+
+	if (ISSET(FIELD_FLAG, field)) {
+		return FIELD_STATE_FLAG;
+	}
+	if (c == NULL || (!game->dead && !ISSET(FIELD_UNCOVERED, field))) {
+		return FIELD_STATE_COVERED;
+	}
+
+	// a lost game shows every field, this expands c
+	mines = field_get_mines(game, c, x, y);
+
+	if (ISSET(FIELD_MINE, c->fields[POS(x, y)])) {
+		return FIELD_STATE_MINE;
+	}
+
+	return mines < 0 ? FIELD_STATE_UNKNOWN : mines;
+}
+
+// Appends a message of type with the states of the fields in rect
+static void reply_fields(struct client *client, const uint8_t type, const struct proto_rect *rect) {
+	struct game *game;
+	struct chunk *c;
+	uint32_t i, x, y, cx, cy, size;
+	uint8_t *out;
+
+	game = client->session->game;
+	size = FIELDS_SIZE(rect->w, rect->h);
+	out = reserve_out(client, 1 + sizeof(*rect) + size);
+
+	if (out == NULL) {
+		return;
+	}
+
+	out[0] = type;
+	memcpy(out + 1, rect, sizeof(*rect));
+	out += 1 + sizeof(*rect);
+	memset(out, 0, size);
+
+	// counting mines can start fills but never sends replies, so out stays valid
+	c = NULL;
+	cx = cy = 0;
+	for (i = 0; i < (uint32_t)rect->w * rect->h; i++) {
+		x = rect->pos.fx + i % rect->w;
+		y = rect->pos.fy + i / rect->w;
+
+		if (i == 0 || rect->pos.cx + x / CHUNK_SIZE != cx || rect->pos.cy + y / CHUNK_SIZE != cy) {
+			cx = rect->pos.cx + x / CHUNK_SIZE;
+			cy = rect->pos.cy + y / CHUNK_SIZE;
+			// a lost game shows the mines of chunks nobody has seen yet
+			c = get_chunk_by_pos(game, cx, cy, game->dead);
+		}
+
+		out[i / 2] |= field_state(game, c, x % CHUNK_SIZE, y % CHUNK_SIZE) << i % 2 * 4;
+	}
+}
+
+// Returns rect moved by x, y fields, which are smaller than REGION_SIZE_MAX
+static struct proto_rect offset_rect(const struct proto_rect *rect, const uint32_t x,
+									 const uint32_t y) {
+	struct proto_rect moved;
+
+	moved = *rect;
+	moved.pos.cx += (rect->pos.fx + x) / CHUNK_SIZE;
+	moved.pos.cy += (rect->pos.fy + y) / CHUNK_SIZE;
+	moved.pos.fx = (rect->pos.fx + x) % CHUNK_SIZE;
+	moved.pos.fy = (rect->pos.fy + y) % CHUNK_SIZE;
+
+	return moved;
+}
+
+// Clips the changed fields of r to rect, returns false if none of them is in it
+static bool clip_rect(const struct proto_rect *rect, const struct dirty_rect *r,
+					  struct proto_rect *part) {
+	int64_t x0, y0, x1, y1;
+
+	// r relative to the first field of rect
+	x0 = (int64_t)(int32_t)(r->x - rect->pos.cx) * CHUNK_SIZE + r->min_x - rect->pos.fx;
+	y0 = (int64_t)(int32_t)(r->y - rect->pos.cy) * CHUNK_SIZE + r->min_y - rect->pos.fy;
+	x1 = x0 + r->max_x - r->min_x;
+	y1 = y0 + r->max_y - r->min_y;
+
+	x0 = x0 < 0 ? 0 : x0;
+	y0 = y0 < 0 ? 0 : y0;
+	x1 = x1 >= rect->w ? rect->w - 1 : x1;
+	y1 = y1 >= rect->h ? rect->h - 1 : y1;
+
+	if (x0 > x1 || y0 > y1) {
+		return false;
+	}
+
+	*part = offset_rect(rect, x0, y0);
+	part->w = x1 - x0 + 1;
+	part->h = y1 - y0 + 1;
+
+	return true;
+}
+
+// Sends the fields that changed since the last call to the subscribers, the fields are read the
+// same way the renderer draws the changed rectangles of the window
+static void publish_changes(struct session *s) {
+	struct dirty_rect rects[DIRTY_RECTS];
+	struct proto_rect part;
+	struct client *client;
+	struct game *game;
+	uint32_t i, count;
+	bool all;
+
+	game = s->game;
+
+	// reading the fields can count mines and start fills, their changes are sent next
+	while (game->dirty || game->dirty_rects_count > 0) {
+		all = game->dirty;
+		count = game->dirty_rects_count;
+		memcpy(rects, game->dirty_rects, sizeof(*rects) * count);
+		game->dirty = false;
+		game->dirty_rects_count = 0;
+
+		for (client = s->clients; client != NULL; client = client->next) {
+			if (client->subscription.w == 0) {
+				continue;
+			}
+
+			if (all) {
+				reply_fields(client, MSG_CHANGED, &client->subscription);
+				continue;
+			}
+
+			for (i = 0; i < count; i++) {
+				if (clip_rect(&client->subscription, &rects[i], &part)) {
+					reply_fields(client, MSG_CHANGED, &part);
+				}
+			}
+		}
+	}
+}
+
+// The client looks at the chunks of rect from now on, fills that stopped at them continue
+static void look_at(struct client *client, const struct proto_rect *rect) {
+	struct game *game;
+	struct chunk *c;
+	uint32_t x, y;
+
+	game = client->session->game;
+
+	client->view_x = rect->pos.cx;
+	client->view_y = rect->pos.cy;
+	client->view_w = (rect->pos.fx + rect->w - 1) / CHUNK_SIZE + 1;
+	client->view_h = (rect->pos.fy + rect->h - 1) / CHUNK_SIZE + 1;
+
+	for (y = 0; y < client->view_h; y++) {
+		for (x = 0; x < client->view_w; x++) {
+			c = get_chunk_by_pos(game, client->view_x + x, client->view_y + y, false);
+
+			if (c != NULL) {
+				is_visible(game, c);
+			}
+		}
+	}
+}
+
+// Handles one request, returns false if it was invalid and the client is dropped
+static bool handle_request(struct client *client, const uint8_t type, const uint8_t *body) {
+	struct proto_result result;
+	struct proto_rect rect;
+	struct proto_pos pos;
+	struct game *game;
+	struct chunk *c;
+
+	game = client->session->game;
+
+	switch (type) {
+	case MSG_UNCOVER:
+	case MSG_FLAG:
+		memcpy(&pos, body, sizeof(pos));
+
+		if (pos.fx >= CHUNK_SIZE || pos.fy >= CHUNK_SIZE) {
+			return false;
+		}
+
+		c = get_chunk_by_pos(game, pos.cx, pos.cy, true);
+
+		if (type == MSG_FLAG) {
+			field_toggle_flag(game, c, pos.fx, pos.fy);
+		} else if (c->fields == NULL || !ISSET(FIELD_FLAG, c->fields[POS(pos.fx, pos.fy)])) {
+			// flagged fields are not uncovered
+			uncover_field_inbounds(game, c, pos.fx, pos.fy);
+		}
+
+		result.dead = game->dead;
+		reply(client, MSG_RESULT, &result, sizeof(result));
+		return true;
+	case MSG_REGION:
+	case MSG_SUBSCRIBE:
+		memcpy(&rect, body, sizeof(rect));
+
+		if (type == MSG_SUBSCRIBE && rect.w == 0) {
+			client->subscription.w = 0;
+			result.dead = game->dead;
+			reply(client, MSG_RESULT, &result, sizeof(result));
+			return true;
+		}
+
+		if (rect.pos.fx >= CHUNK_SIZE || rect.pos.fy >= CHUNK_SIZE || rect.w == 0 ||
+			rect.h == 0 || rect.w > REGION_SIZE_MAX || rect.h > REGION_SIZE_MAX) {
+			return false;
+		}
+
+		look_at(client, &rect);
+		if (type == MSG_SUBSCRIBE) {
+			client->subscription = rect;
+		}
+
+		reply_fields(client, MSG_FIELDS, &rect);
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Handles the complete requests client sent, then sends the changes to the subscribers and evicts
+// chunks if the game uses more memory than its budget, the requests of one read are one tick
+static void handle_requests(struct client *client) {
+	struct session *s;
+	struct game *game;
+	uint32_t used, size;
+	uint8_t type;
+
+	s = client->session;
+	game = s->game;
+
+	used = 0;
+	while (used < client->in_count && !client->dropped) {
+		TRACE_BEGIN(start);
+
+		type = client->in[used];
+		size = request_size(type);
+
+		if (size == 0) {
+			reply_error(client, ERROR_REQUEST);
+			flush_client(client);
+			drop_client(client);
+			break;
+		}
+		if (client->in_count - used < 1 + size) {
+			break;
+		}
+
+		if (!handle_request(client, type, client->in + used + 1)) {
+			reply_error(client, ERROR_REQUEST);
+			flush_client(client);
+			drop_client(client);
+			break;
+		}
+
+		used += 1 + size;
+		s->shard->requests++;
+
+		TRACE_END(start, "request", "type", type, "session", s->id);
+	}
+
+	client->in_count -= used;
+	memmove(client->in, client->in + used, client->in_count);
+
+	publish_changes(s);
+
+	// the queue of changed summaries is updated once per frame in the game
+	update_lod(game);
+	evict_chunks(game);
+}
+
+// Closes the connection of client and leaves its session, the shard does not use client after this
+static void close_client(struct client *client) {
+	struct client **link;
+	struct session *s;
+
+	s = client->session;
+
+	epoll_ctl(s->shard->epoll, EPOLL_CTL_DEL, client->fd, NULL);
+	close(client->fd);
+
+	for (link = &s->clients; *link != client; link = &(*link)->next) {
+	}
+	*link = client->next;
+
+	free(client->out);
+	free(client);
+
+	leave_session(s);
+}
+
+static void read_client(struct client *client) {
+	ssize_t n;
+
+	if (client->dropped) {
+		close_client(client);
+		return;
+	}
+
+	n = recv(client->fd, client->in + client->in_count, CLIENT_IN_SIZE - client->in_count, 0);
+
+	if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return;
+	}
+	if (n <= 0) {
+		close_client(client);
+		return;
+	}
+
+	client->in_count += n;
+	handle_requests(client);
+	flush_session(client->session);
+}
+
+// Adds the clients the acceptor handed over, a session gets its game with its first client
+static void adopt_clients(struct shard *shard) {
+	struct epoll_event event;
+	struct client *client, *inbox;
+	struct proto_join joined;
+	struct session *s;
+	uint64_t count;
+
+	if (read(shard->wakeup, &count, sizeof(count)) < 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&shard->inbox_lock);
+	inbox = shard->inbox;
+	shard->inbox = NULL;
+	pthread_mutex_unlock(&shard->inbox_lock);
+
+	while (inbox != NULL) {
+		client = inbox;
+		inbox = client->next;
+		s = client->session;
+
+		if (s->game == NULL) {
+			s->game = init_game(s->seed);
+			s->game->memory_budget = SESSION_MEMORY_BUDGET;
+			// nobody subscribed yet
+			s->game->dirty = false;
+			s->game->visibility = session_sees;
+			s->game->visibility_data = s;
+		}
+
+		client->next = s->clients;
+		s->clients = client;
+
+		event.events = EPOLLIN;
+		event.data.ptr = client;
+		if (epoll_ctl(shard->epoll, EPOLL_CTL_ADD, client->fd, &event) != 0) {
+			perror("Could not add a client to its shard");
+			close_client(client);
+			continue;
+		}
+
+		joined.session = s->id;
+		joined.seed = s->seed;
+		reply(client, MSG_JOINED, &joined, sizeof(joined));
+
+		// requests sent right after MSG_JOIN
+		handle_requests(client);
+		flush_session(s);
+	}
+}
+
+static void *run_shard(void *arg) {
+	struct epoll_event events[SERVER_EVENTS];
+	struct shard *shard;
+	struct client *client;
+	int i, n;
+
+	shard = arg;
+	trace_thread_name("shard");
+
+	while (!atomic_load(&stopping)) {
+		n = epoll_wait(shard->epoll, events, SERVER_EVENTS, -1);
+
+		for (i = 0; i < n; i++) {
+			client = events[i].data.ptr;
+
+			if (client == NULL) {
+				adopt_clients(shard);
+				continue;
+			}
+
+			if (ISSET(EPOLLOUT, events[i].events) && !client->dropped) {
+				flush_client(client);
+			}
+			if (ISSET(EPOLLIN | EPOLLERR | EPOLLHUP, events[i].events) || client->dropped) {
+				read_client(client);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static void start_shards(const uint32_t count) {
+	struct epoll_event event;
+	uint32_t i;
+
+	shards_count = count;
+
+	for (i = 0; i < count; i++) {
+		shards[i].epoll = epoll_create1(EPOLL_CLOEXEC);
+		shards[i].wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+		if (shards[i].epoll < 0 || shards[i].wakeup < 0) {
+			perror("Could not start the shards");
+			exit(1);
+		}
+
+		event.events = EPOLLIN;
+		event.data.ptr = NULL;
+		epoll_ctl(shards[i].epoll, EPOLL_CTL_ADD, shards[i].wakeup, &event);
+		pthread_mutex_init(&shards[i].inbox_lock, NULL);
+
+		if (pthread_create(&shards[i].thread, NULL, run_shard, &shards[i]) != 0) {
+			printf("Could not start the shards\n");
+			exit(1);
+		}
+	}
+}
+
+static void wake_shard(struct shard *shard) {
+	const uint64_t one = 1;
+
+	if (write(shard->wakeup, &one, sizeof(one)) < 0) {
+		perror("Could not wake up a shard");
+	}
+}
+
+// Stops the shards and ends the sessions that are left
+static void stop_shards() {
+	struct client *client;
+	struct session *s;
+	uint32_t i;
+
+	atomic_store(&stopping, true);
+
+	for (i = 0; i < shards_count; i++) {
+		wake_shard(&shards[i]);
+		pthread_join(shards[i].thread, NULL);
+	}
+
+	for (i = 0; i < sessions_count; i++) {
+		s = sessions[i];
+
+		if (s == NULL) {
+			continue;
+		}
+
+		while (s->clients != NULL) {
+			client = s->clients;
+			s->clients = client->next;
+			close(client->fd);
+			free(client->out);
+			free(client);
+		}
+
+		if (s->game != NULL) {
+			free_game(s->game);
+		}
+
+		free(s);
+	}
+
+	free(sessions);
+}
+
+// Hands client to the shard of its session
+static void hand_over(struct client *client) {
+	struct shard *shard;
+
+	shard = client->session->shard;
+
+	pthread_mutex_lock(&shard->inbox_lock);
+	client->next = shard->inbox;
+	shard->inbox = client;
+	pthread_mutex_unlock(&shard->inbox_lock);
+
+	wake_shard(shard);
+}
+
+static void send_error(const int fd, const uint8_t code) {
+	const uint8_t message[] = {MSG_ERROR, code};
+
+	// the client did not send anything else yet, the socket has room for this
+	send(fd, message, sizeof(message), MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+// Reads the MSG_JOIN of a client that has no session yet and hands it to the shard of its session
+static void read_join(const int epoll, struct client *client) {
+	struct proto_join join;
+	ssize_t n;
+
+	n = recv(client->fd, client->in + client->in_count, CLIENT_IN_SIZE - client->in_count, 0);
+
+	if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return;
+	}
+	if (n <= 0) {
+		close(client->fd);
+		free(client);
+		return;
+	}
+
+	client->in_count += n;
+
+	while (client->in_count > 0) {
+		if (client->in[0] != MSG_JOIN) {
+			send_error(client->fd, ERROR_REQUEST);
+			close(client->fd);
+			free(client);
+			return;
+		}
+		if (client->in_count < 1 + sizeof(join)) {
+			return;
+		}
+
+		memcpy(&join, client->in + 1, sizeof(join));
+		client->in_count -= 1 + sizeof(join);
+		memmove(client->in, client->in + 1 + sizeof(join), client->in_count);
+
+		client->session = join_session(&join);
+
+		if (client->session != NULL) {
+			epoll_ctl(epoll, EPOLL_CTL_DEL, client->fd, NULL);
+			hand_over(client);
+			return;
+		}
+
+		send_error(client->fd, ERROR_SESSION);
+	}
+}
+
+// Accepts clients until SIGINT or SIGTERM arrives on signals
+static void run_acceptor(const int listener, const int signals) {
+	struct epoll_event event, events[SERVER_EVENTS];
+	struct client *client;
+	int epoll, fd, i, n;
+
+	epoll = epoll_create1(EPOLL_CLOEXEC);
+
+	if (epoll < 0) {
+		perror("Could not accept clients");
+		return;
+	}
+
+	// the listener and signals are told apart from the clients by their pointers
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event);
+	event.data.ptr = (void *)&signals;
+	epoll_ctl(epoll, EPOLL_CTL_ADD, signals, &event);
+
+	for (;;) {
+		n = epoll_wait(epoll, events, SERVER_EVENTS, -1);
+
+		for (i = 0; i < n; i++) {
+			if (events[i].data.ptr == &signals) {
+				close(epoll);
+				return;
+			}
+
+			if (events[i].data.ptr != NULL) {
+				read_join(epoll, events[i].data.ptr);
+				continue;
+			}
+
+			while ((fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+				client = calloc(1, sizeof(struct client));
+
+				if (client == NULL) {
+					handle_alloc_error();
+				}
+
+				client->fd = fd;
+				event.events = EPOLLIN;
+				event.data.ptr = client;
+				epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event);
+			}
+
+			if (errno == EMFILE || errno == ENFILE) {
+				perror("Could not accept a client");
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	struct sockaddr_un address = {.sun_family = AF_UNIX};
+	const char *path;
+	struct rlimit limit;
+	uint64_t requests;
+	sigset_t mask;
+	uint32_t count, i;
+	int listener, signals;
+
+	path = SERVER_SOCKET;
+	count = cpu_count();
+
+	if (argc > 3 || (argc > 2 && (sscanf(argv[2], "%u", &count) != 1 || count == 0 ||
+								  count > SERVER_SHARDS_MAX))) {
+		printf("Usage: %s [socket] [shards (1 to %u)]\n", argv[0], SERVER_SHARDS_MAX);
+		return 1;
+	}
+	if (argc > 1) {
+		path = argv[1];
+	}
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		printf("Socket path %s is too long\n", path);
+		return 1;
+	}
+	strcpy(address.sun_path, path);
+
+	// every client is a file descriptor
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	// the shards inherit the mask, the signals only arrive on signals
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+	signals = signalfd(-1, &mask, SFD_CLOEXEC);
+
+	listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	unlink(path);
+
+	if (signals < 0 || listener < 0 || bind(listener, (struct sockaddr *)&address,
+											sizeof(address)) != 0 ||
+		listen(listener, SOMAXCONN) != 0) {
+		perror("Could not listen");
+		return 1;
+	}
+
+	start_trace(SERVER_TRACE_FILE);
+	start_shards(count);
+
+	printf("Listening on %s with %u shards\n", path, count);
+	fflush(stdout);
+
+	run_acceptor(listener, signals);
+
+	stop_shards();
+
+	requests = 0;
+	for (i = 0; i < shards_count; i++) {
+		requests += shards[i].requests;
+	}
+	printf("%u sessions, %llu requests\n", sessions_count, (unsigned long long)requests);
+
+	close(listener);
+	unlink(path);
+	flush_trace();
+
+	return 0;
+}
+
+#endif
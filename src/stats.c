@@ -0,0 +1,63 @@
+#include "stats.h"
+
+#include "arena.h"
+#include "evict.h"
+#include "game.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *const stat_names[STAT_COUNT] = {
+	[STAT_FRAMES] = "frames",
+	[STAT_EVENT_NS] = "event_ns",
+	[STAT_RENDER_NS] = "render_ns",
+	[STAT_PRESENT_NS] = "present_ns",
+	[STAT_CHUNK_LOOKUPS] = "chunk_lookups",
+	[STAT_CHUNKS_CREATED] = "chunks_created",
+	[STAT_CHUNKS_POPULATED] = "chunks_populated",
+	[STAT_CHUNKS_PREFETCHED] = "chunks_prefetched",
+	[STAT_MINES_HITS] = "mines_hits",
+	[STAT_MINES_MISSES] = "mines_misses",
+	[STAT_FILLS] = "fills",
+	[STAT_FILL_CELLS] = "fill_cells",
+	[STAT_LAST_FILL_CELLS] = "last_fill_cells",
+	[STAT_CHUNKS_LIVE] = "chunks_live",
+	[STAT_CHUNKS_MINES] = "chunks_mines",
+	[STAT_CHUNKS_FIELDS] = "chunks_fields",
+	[STAT_CHUNK_BYTES] = "chunk_bytes",
+};
+
+const char *stat_name(const enum game_stat stat) {
+	return stat_names[stat];
+}
+
+// Copies the counters of the game to stats and adds the ones that are read from the game. Without
+// counters (NO_STATS) they are 0.
+void read_stats(struct game *game, uint64_t stats[STAT_COUNT]) {
+#ifdef NO_STATS
+	memset(stats, 0, sizeof(uint64_t) * STAT_COUNT);
+#else
+	memcpy(stats, game->stats, sizeof(game->stats));
+#endif
+
+	stats[STAT_CHUNKS_LIVE] = game->chunks_count;
+	stats[STAT_CHUNKS_MINES] = game->mines_arena.object_count;
+	stats[STAT_CHUNKS_FIELDS] = game->fields_arena.object_count;
+	stats[STAT_CHUNK_BYTES] = chunk_memory(game);
+}
+
+// Prints all stats as one line of space separated key=value pairs, starting with stats=name
+void print_stats(struct game *game, const char *name) {
+	uint64_t stats[STAT_COUNT];
+	int i;
+
+	read_stats(game, stats);
+
+	printf("stats=%s", name);
+	for (i = 0; i < STAT_COUNT; i++) {
+		printf(" %s=%llu", stat_names[i], (unsigned long long)stats[i]);
+	}
+	printf("\n");
+	fflush(stdout);
+}
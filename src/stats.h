@@ -0,0 +1,54 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+// Counters of the hot paths, kept in game->stats of the game in scope and only changed by the
+// thread that plays it. Build with -DNO_STATS to compile them out, STAT_ADD and STAT_SET do nothing
+// and STAT_GET is 0 then.
+enum game_stat {
+	// frames rendered and the time spent handling events, drawing and presenting them
+	STAT_FRAMES,
+	STAT_EVENT_NS,
+	STAT_RENDER_NS,
+	STAT_PRESENT_NS,
+	STAT_CHUNK_LOOKUPS,
+	STAT_CHUNKS_CREATED,
+	STAT_CHUNKS_POPULATED,
+	STAT_CHUNKS_PREFETCHED,
+	// field_get_mines calls that found the count cached and that had to count
+	STAT_MINES_HITS,
+	STAT_MINES_MISSES,
+	// fields expanded by flood fills, and by the fill of the last uncovered field
+	STAT_FILLS,
+	STAT_FILL_CELLS,
+	STAT_LAST_FILL_CELLS,
+	// read from the game by read_stats, not counted: live chunks, the ones of them with mines and
+	// with fields, and the bytes they use
+	STAT_CHUNKS_LIVE,
+	STAT_CHUNKS_MINES,
+	STAT_CHUNKS_FIELDS,
+	STAT_CHUNK_BYTES,
+	STAT_COUNT
+};
+
+#ifdef NO_STATS
+#define STAT_ADD(stat, n) ((void)0)
+#define STAT_SET(stat, n) ((void)0)
+#define STAT_GET(stat) ((uint64_t)0)
+#else
+#define STAT_ADD(stat, n) (game->stats[stat] += (n))
+#define STAT_SET(stat, n) (game->stats[stat] = (n))
+#define STAT_GET(stat) (game->stats[stat])
+#endif
+
+// see game.h
+struct game;
+
+const char *stat_name(const enum game_stat stat);
+
+void read_stats(struct game *game, uint64_t stats[STAT_COUNT]);
+
+void print_stats(struct game *game, const char *name);
+
+#endif
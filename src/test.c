@@ -1,64 +1,142 @@
 #ifdef TEST
 
+#include "chunk.h"
 #include "game.h"
-#include "renderer.h"
+#include "util.h"
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
-struct test_case1 {
-	int x, y;
-};
+// compares populate_chunk with the plain serial xorshift32 stream it replaces
+int test_populate(struct game *game, const uint32_t seed, const uint32_t mine_threshold) {
+	static struct chunk c;
+	uint32_t i, state;
+	bool mine;
+
+	// c keeps its mines from the last call
+	UNSET(CHUNK_POPULATED, c.flags);
+	c.seed = seed;
+	game->mine_threshold = mine_threshold;
+	populate_chunk(game, &c);
+
+	state = seed;
+	for (i = 0; i < CHUNK_SIZE * CHUNK_SIZE; i++) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		mine = state > mine_threshold;
+
+		if (mine != (c.mines[i / CHUNK_SIZE] >> i % CHUNK_SIZE & 1)) {
+			printf("populate seed=%u threshold=%u field=%u\n", seed, mine_threshold, i);
+			return 0;
+		}
+	}
 
-struct test_case2 {
-	uint32_t cx, cy, fx, fy;
-};
+	return 1;
+}
 
-struct test_case1 *random_case1() {
-	static struct test_case1 test;
+// compares the flood fill with a plain one field at a time fill inside chunk x, 0, no chunk is
+// visible so the fill can not expand fields on the edge
+int test_fill(struct game *game, const uint32_t x, const uint32_t mine_threshold) {
+	static bool uncovered[CHUNK_SIZE * CHUNK_SIZE];
+	static uint16_t stack[CHUNK_SIZE * CHUNK_SIZE];
+	struct chunk *c;
+	uint32_t i, count, start, pos, fx, fy, mines;
+	int32_t nx, ny, j, k;
+
+	game->mine_threshold = mine_threshold;
+	c = get_chunk_by_pos(game, x, 0, true);
+
+	for (pos = POS(1, 1); pos < POS(0, CHUNK_POS_MAX); pos++) {
+		if (pos % CHUNK_SIZE != 0 && pos % CHUNK_SIZE != CHUNK_POS_MAX &&
+			field_get_mines(game, c, pos % CHUNK_SIZE, pos / CHUNK_SIZE) == 0 &&
+			!ISSET(FIELD_MINE, c->fields[pos])) {
+			break;
+		}
+	}
+	if (pos == POS(0, CHUNK_POS_MAX)) {
+		return 1;
+	}
 
-	test.x = rand();
-	test.y = rand();
+	// the fields got the mines of the chunk when they were added
+	for (i = 0; i < CHUNK_SIZE * CHUNK_SIZE; i++) {
+		mines = c->mines[i / CHUNK_SIZE] >> i % CHUNK_SIZE & 1;
+		if ((ISSET(FIELD_MINE, c->fields[i]) != 0) != mines) {
+			printf("fields chunk=%u threshold=%u field=%u\n", x, mine_threshold, i);
+			return 0;
+		}
+	}
 
-	return &test;
-}
+	start = pos;
+	memset(uncovered, 0, sizeof(uncovered));
+	uncovered[start] = true;
+	stack[0] = start;
+	count = 1;
+	while (count > 0) {
+		pos = stack[--count];
+		fx = pos % CHUNK_SIZE;
+		fy = pos / CHUNK_SIZE;
+		if (fx == 0 || fx == CHUNK_POS_MAX || fy == 0 || fy == CHUNK_POS_MAX) {
+			continue;
+		}
 
-int test1(struct test_case1 *test) {
-	uint32_t cx, cy, fx, fy;
-	int x, y;
-	printf(" -> x=%d y=%d\n", test->x, test->y);
-	screen_to_game(test->x, test->y, &cx, &cy, &fx, &fy);
-	printf("    cx=%u cy=%u fx=%u fy=%u\n", cx, cy, fx, fy);
-	game_to_screen(cx, cy, fx, fy, &x, &y);
-	printf(" <- x=%d y=%d\n\n", x, y);
-	return test->x - x <= 16 && test->x - x > -16 && test->y - y <= 16 && test->y - y > -16;
-}
+		mines = 0;
+		for (j = -1; j <= 1; j++) {
+			for (k = -1; k <= 1; k++) {
+				mines += c->mines[fy + j] >> (fx + k) & 1;
+			}
+		}
+		if (mines != 0) {
+			continue;
+		}
 
-int test2(struct test_case2 *test) {
-	uint32_t cx, cy, fx, fy;
-	int x, y;
-	game_to_screen(test->cx, test->cy, test->fx, test->fy, &x, &y);
-	screen_to_game(x, y, &cx, &cy, &fx, &fy);
-	return test->cx == cx && test->cy == cy && test->fx == fx && test->fy == fy;
-}
+		for (j = -1; j <= 1; j++) {
+			for (k = -1; k <= 1; k++) {
+				nx = fx + k;
+				ny = fy + j;
+				if (!uncovered[POS(nx, ny)]) {
+					uncovered[POS(nx, ny)] = true;
+					stack[count++] = POS(nx, ny);
+				}
+			}
+		}
+	}
+
+	uncover_field_inbounds(game, c, start % CHUNK_SIZE, start / CHUNK_SIZE);
+
+	for (i = 0; i < CHUNK_SIZE * CHUNK_SIZE; i++) {
+		if (uncovered[i] != (ISSET(FIELD_UNCOVERED, c->fields[i]) != 0)) {
+			printf("fill chunk=%u threshold=%u field=%u\n", x, mine_threshold, i);
+			return 0;
+		}
+	}
 
-struct test_case1 cases1[] = {
-	{0, 0}, {1, 1}, {-1, -1}, {INT32_MAX, INT32_MAX}, {INT32_MIN, INT32_MIN}};
+	return 1;
+}
 
 int main() {
+	struct game *game;
 	int i;
 
-	if (init_game(0)) {
-		return 1;
-	}
+	// no visibility hook, no chunk is visible
+	game = init_game(0);
 
 	srand(time(NULL));
 
-	for (i = 0; i < sizeof(cases1) / sizeof(cases1[0]); i++) {
-		if (!test1(&cases1[i])) {
+	for (i = 0; i < 10000; i++) {
+		if (!test_populate(game, rand() | 1, i % 2 ? DEFAULT_MINE_THRESHOLD : rand())) {
+			printf("fail\n");
+			return 1;
+		}
+	}
+
+	for (i = 0; i < 1000; i++) {
+		if (!test_fill(game, i * 3, -1U / 100 * (100 - 2 - rand() % 20))) {
 			printf("fail\n");
-			// return 1;
+			return 1;
 		}
 	}
 
@@ -0,0 +1,195 @@
+#include "trace.h"
+
+#ifdef TRACE
+
+#include "util.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef TRACE_THREADS
+#include <pthread.h>
+#endif
+
+// a finished event, names point to string literals
+struct trace_event {
+	const char *name, *arg0, *arg1;
+	uint64_t start, duration;
+	int64_t value0, value1;
+};
+
+// The events of one thread since the last flush, head is the number of events recorded, the last
+// TRACE_EVENTS of them are kept. Rings outlive their threads, they are linked in traces.
+struct trace_ring {
+	struct trace_event events[TRACE_EVENTS];
+	uint64_t head;
+	// name_written is set when the name is in the trace file
+	const char *name;
+	bool name_written;
+	uint32_t tid;
+	struct trace_ring *next;
+};
+
+static _Thread_local struct trace_ring *ring = NULL;
+static struct trace_ring *traces = NULL;
+static uint32_t trace_threads = 0;
+// the file the trace is written to by flush_trace, NULL when it is not written, and the number of
+// events in it
+static FILE *trace_file = NULL;
+static const char *trace_path;
+static uint64_t trace_written = 0;
+#ifdef TRACE_THREADS
+static pthread_mutex_t traces_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+uint64_t trace_now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// the ring of the calling thread, created when the thread records its first event
+static struct trace_ring *get_ring() {
+	if (ring != NULL) {
+		return ring;
+	}
+
+	ring = malloc(sizeof(struct trace_ring));
+
+	if (ring == NULL) {
+		handle_alloc_error();
+	}
+
+	ring->head = 0;
+	ring->name = NULL;
+	ring->name_written = false;
+
+#ifdef TRACE_THREADS
+	pthread_mutex_lock(&traces_lock);
+#endif
+	ring->tid = trace_threads++;
+	ring->next = traces;
+	traces = ring;
+#ifdef TRACE_THREADS
+	pthread_mutex_unlock(&traces_lock);
+#endif
+
+	return ring;
+}
+
+// records an event from start until now, see TRACE_END
+void trace_event(const char *name, const uint64_t start, const char *arg0, const int64_t value0,
+				 const char *arg1, const int64_t value1) {
+	struct trace_ring *r;
+	struct trace_event *e;
+	uint64_t end;
+
+	end = trace_now();
+	r = get_ring();
+
+	e = &r->events[r->head % TRACE_EVENTS];
+	e->name = name;
+	e->start = start;
+	e->duration = end - start;
+	e->arg0 = arg0;
+	e->value0 = value0;
+	e->arg1 = arg1;
+	e->value1 = value1;
+
+	r->head++;
+}
+
+// names the calling thread in the trace, name has to be a string literal
+void trace_thread_name(const char *name) {
+	get_ring()->name = name;
+}
+
+static void write_event(FILE *f, const struct trace_event *e, const uint32_t tid) {
+	fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+			trace_written > 0 ? "," : "", e->name, tid, e->start / 1e3, e->duration / 1e3);
+
+	if (e->arg0 != NULL) {
+		fprintf(f, ",\"args\":{\"%s\":%lld", e->arg0, (long long)e->value0);
+		if (e->arg1 != NULL) {
+			fprintf(f, ",\"%s\":%lld", e->arg1, (long long)e->value1);
+		}
+		fprintf(f, "}");
+	}
+
+	fprintf(f, "}\n");
+	trace_written++;
+}
+
+// Starts the trace in file, the events are written to it by every flush_trace
+void start_trace(const char *file) {
+	trace_file = fopen(file, "w");
+
+	if (trace_file == NULL) {
+		printf("Could not write the trace to %s\n", file);
+		return;
+	}
+
+	trace_path = file;
+	trace_written = 0;
+	fprintf(trace_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n]}\n");
+}
+
+// Appends the events of all threads to the trace file and empties the rings, call this when no
+// other thread records events. The file is a complete trace after every flush.
+void flush_trace() {
+	struct trace_ring *r;
+	uint64_t i, dropped, written;
+
+	dropped = 0;
+	written = trace_written;
+
+	// continue the event array in front of its end
+	if (trace_file != NULL) {
+		fseek(trace_file, -3, SEEK_END);
+	}
+
+	for (r = traces; r != NULL; r = r->next) {
+		if (trace_file == NULL) {
+			r->head = 0;
+			continue;
+		}
+
+		if (r->name != NULL && !r->name_written) {
+			fprintf(trace_file,
+					"%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+					"\"args\":{\"name\":\"%s\"}}\n",
+					trace_written > 0 ? "," : "", r->tid, r->name);
+			trace_written++;
+			r->name_written = true;
+		}
+
+		i = r->head > TRACE_EVENTS ? r->head - TRACE_EVENTS : 0;
+		dropped += i;
+		for (; i < r->head; i++) {
+			write_event(trace_file, &r->events[i % TRACE_EVENTS], r->tid);
+		}
+
+		r->head = 0;
+	}
+
+	if (trace_file == NULL) {
+		return;
+	}
+
+	fprintf(trace_file, "]}\n");
+	fflush(trace_file);
+
+	printf("Wrote %llu trace events to %s", (unsigned long long)(trace_written - written),
+		   trace_path);
+	if (dropped > 0) {
+		printf(", the oldest %llu events were overwritten", (unsigned long long)dropped);
+	}
+	printf("\n");
+}
+
+#endif
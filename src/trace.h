@@ -0,0 +1,51 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Building with -DTRACE records scoped events of the main loop, the renderer and the game core and
+// writes them to TRACE_FILE in cleanup, in the trace event format of chrome://tracing and Perfetto.
+// Every thread records into its own ring of TRACE_EVENTS events, older events are overwritten, so
+// recording takes no lock and does no I/O while the frames are measured. Without start_trace the
+// events are dropped.
+#define TRACE_FILE "minesweeper.trace.json"
+#define TRACE_EVENTS (1 << 15)
+
+#ifdef TRACE
+
+// the ring of a thread is registered under a lock, the web build only has threads with -pthread
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+#define TRACE_THREADS
+#endif
+
+// TRACE_BEGIN(start) declares start, the begin of the event, TRACE_END(start, name, ...) records
+// the event from then on with up to two named integer arguments (NULL names for none).
+// TRACE_VALUE(name, value) keeps a value for the arguments, it is not evaluated without tracing.
+#define TRACE_BEGIN(start) const uint64_t start = trace_now()
+#define TRACE_VALUE(name, value) const int64_t name = (value)
+#define TRACE_END(start, name, arg0, value0, arg1, value1)                                         \
+	trace_event(name, start, arg0, value0, arg1, value1)
+
+uint64_t trace_now();
+
+void trace_event(const char *name, const uint64_t start, const char *arg0, const int64_t value0,
+				 const char *arg1, const int64_t value1);
+
+void trace_thread_name(const char *name);
+
+void start_trace(const char *file);
+
+void flush_trace();
+
+#else
+
+#define TRACE_BEGIN(start)
+#define TRACE_VALUE(name, value)
+#define TRACE_END(start, name, arg0, value0, arg1, value1)
+#define trace_thread_name(name)
+#define start_trace(file)
+#define flush_trace()
+
+#endif
+
+#endif
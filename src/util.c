@@ -7,3 +7,10 @@ void handle_alloc_error() {
 	printf("Failed to allocate memory\n");
 	exit(1);
 }
+
+// int_div_round_down(a, 1 << s) == a >> s, where a is an int64_t and s a number valid for bit
+// shifting an int64_t. The return value for values of b that are not powers of two is equivalent
+// but can not be expressed using a bit shift.
+int64_t int_div_round_down(const int64_t a, const int64_t b) {
+	return a / b - (a < 0 && a % b != 0);
+}
@@ -11,4 +11,6 @@
 
 void handle_alloc_error();
 
+int64_t int_div_round_down(const int64_t a, const int64_t b);
+
 #endif